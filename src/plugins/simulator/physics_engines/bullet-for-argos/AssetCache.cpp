@@ -0,0 +1,148 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "AssetCache.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+/**
+ * Where cache files go, empty for next to the asset
+ */
+static std::string cacheDirectory;
+
+/**
+ * Hash the file in blocks
+ */
+uint64_t hashFile(const std::string& fileName)
+{
+	std::ifstream file{fileName, std::ios::binary};
+	if(!file)
+		return 0;
+
+	uint64_t hash = 14695981039346656037ULL;
+	char buffer[65536];
+	while(file.read(buffer, sizeof(buffer)) || file.gcount())
+	{
+		for(std::streamsize i = 0; i < file.gcount(); ++i)
+		{
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+/**
+ * Change the cache directory, adding a trailing separator if needed
+ */
+void setAssetCacheDirectory(const std::string& directory)
+{
+	cacheDirectory = directory;
+	if(!cacheDirectory.empty() && cacheDirectory.back() != '/')
+		cacheDirectory += '/';
+}
+
+/**
+ * Build the cache file name from the asset's name and the tag
+ */
+std::string assetCachePath(const std::string& assetFile, const std::string& tag)
+{
+	if(cacheDirectory.empty())
+		return assetFile + "." + tag;
+
+	size_t pathEnd = assetFile.find_last_of('/');
+	std::string name = pathEnd == std::string::npos ? assetFile : assetFile.substr(pathEnd + 1);
+	return cacheDirectory + name + "." + tag;
+}
+
+/**
+ * Slurp the file
+ */
+bool readAssetCache(const std::string& cacheFile, std::vector<char>& data)
+{
+	std::ifstream file{cacheFile, std::ios::binary};
+	if(!file)
+		return false;
+
+	data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !file.bad();
+}
+
+/**
+ * Write to a file unique to this process and thread then move it over the real name
+ */
+bool writeAssetCache(const std::string& cacheFile, const std::vector<char>& data)
+{
+	std::ostringstream tempName;
+	tempName << cacheFile << ".tmp" << getpid() << "." << std::this_thread::get_id();
+
+	{
+		std::ofstream file{tempName.str(), std::ios::binary | std::ios::trunc};
+		if(!file)
+			return false;
+
+		file.write(data.data(), data.size());
+		if(!file)
+		{
+			file.close();
+			std::remove(tempName.str().c_str());
+			return false;
+		}
+	}
+
+	if(std::rename(tempName.str().c_str(), cacheFile.c_str()) != 0)
+	{
+		std::remove(tempName.str().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Map the file copy-on-write, the descriptor isn't needed once the mapping exists
+ */
+bool mapAssetCache(const std::string& cacheFile, SMappedAsset& mapping)
+{
+	int fd = open(cacheFile.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return false;
+
+	mapping.data = static_cast<char*>(data);
+	mapping.size = (size_t)info.st_size;
+	return true;
+}
+
+/**
+ * Unmap and forget the mapping
+ */
+void unmapAssetCache(SMappedAsset& mapping)
+{
+	if(mapping.data)
+		munmap(mapping.data, mapping.size);
+
+	mapping.data = nullptr;
+	mapping.size = 0;
+}
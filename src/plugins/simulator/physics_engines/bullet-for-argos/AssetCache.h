@@ -0,0 +1,91 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_ASSETCACHE_H
+#define ARGOS3_BULLET_ASSETCACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Helpers for storing preprocessed asset data (hulls, decompositions, BVHs...) on disk so
+ * the expensive work is only ever done once per asset. Cache files are named after the
+ * asset plus a tag describing the processing and any parameters, so a changed asset or
+ * setting simply produces a new file.
+ */
+
+/**
+ * 64 bit FNV-1a hash of a file's contents, 0 if it can't be read
+ */
+uint64_t hashFile(const std::string& fileName);
+
+/**
+ * Set where cache files are written, an empty directory (the default) puts them next to their asset
+ */
+void setAssetCacheDirectory(const std::string& directory);
+
+/**
+ * Full path of the cache file for an asset and tag
+ */
+std::string assetCachePath(const std::string& assetFile, const std::string& tag);
+
+/**
+ * Read a whole cache file, returning false if it doesn't exist
+ */
+bool readAssetCache(const std::string& cacheFile, std::vector<char>& data);
+
+/**
+ * Write a cache file. The data is written to a temporary file first and renamed into place so
+ * concurrent experiments never see a partial file. Failure (read-only directory...) is not an error.
+ */
+bool writeAssetCache(const std::string& cacheFile, const std::vector<char>& data);
+
+/**
+ * A cache file mapped into memory
+ */
+struct SMappedAsset
+{
+	char* data = nullptr;
+	size_t size = 0;
+};
+
+/**
+ * Map a whole cache file into memory, returning false if it doesn't exist. The mapping is private so it can be
+ * written to (fixing up pointers in place...) without changing the file, untouched pages stay shared between processes.
+ */
+bool mapAssetCache(const std::string& cacheFile, SMappedAsset& mapping);
+
+/**
+ * Release a mapping made by mapAssetCache, leaving it empty
+ */
+void unmapAssetCache(SMappedAsset& mapping);
+
+/**
+ * Append raw values to a cache buffer
+ */
+template<typename T>
+inline void appendToCache(std::vector<char>& data, const T* values, size_t count)
+{
+	const char* bytes = reinterpret_cast<const char*>(values);
+	data.insert(data.end(), bytes, bytes + count * sizeof(T));
+}
+
+/**
+ * Read raw values from a cache buffer at the given offset, advancing it. Returns false if the buffer is too short.
+ */
+template<typename T>
+inline bool readFromCache(const std::vector<char>& data, size_t& offset, T* values, size_t count)
+{
+	size_t size = count * sizeof(T);
+	if(offset + size > data.size())
+		return false;
+
+	std::copy(data.begin() + offset, data.begin() + offset + size, reinterpret_cast<char*>(values));
+	offset += size;
+	return true;
+}
+
+#endif //ARGOS3_BULLET_ASSETCACHE_H
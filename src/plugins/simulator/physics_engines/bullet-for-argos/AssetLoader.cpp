@@ -0,0 +1,167 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "AssetLoader.h"
+
+#include <chrono>
+
+/**
+ * Created on first use and kept until the process exits
+ */
+AssetLoader& AssetLoader::GetInstance()
+{
+	static AssetLoader instance;
+	return instance;
+}
+
+/**
+ * Start one worker per hardware core
+ */
+AssetLoader::AssetLoader()
+{
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	if(numThreads == 0)
+		numThreads = 1;
+
+	for(unsigned int i = 0; i < numThreads; ++i)
+		workers.emplace_back(&AssetLoader::WorkerLoop, this);
+}
+
+/**
+ * Ask all workers to exit once the queue is empty and wait for them
+ */
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	// A load can end the process itself (exit on a bad definition...), it can't wait for its own thread
+	for(auto& worker : workers)
+	{
+		if(worker.get_id() == std::this_thread::get_id())
+			worker.detach();
+		else
+			worker.join();
+	}
+}
+
+/**
+ * Queue the load and wake a worker for it
+ */
+std::shared_future<void> AssetLoader::Submit(std::function<void()> task)
+{
+	std::packaged_task<void()> packaged{std::move(task)};
+	std::shared_future<void> result = packaged.get_future().share();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(packaged));
+	}
+	wakeCondition.notify_one();
+
+	return result;
+}
+
+/**
+ * Hold the load back until its prerequisite is ready, checked under the lock so a finishing load can't miss it
+ */
+std::shared_future<void> AssetLoader::SubmitAfter(const std::shared_future<void>& prerequisite, std::function<void()> task)
+{
+	std::packaged_task<void()> packaged{std::move(task)};
+	std::shared_future<void> result = packaged.get_future().share();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(prerequisite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			deferred.emplace_back(prerequisite, std::move(packaged));
+			return result;
+		}
+
+		tasks.push_back(std::move(packaged));
+	}
+	wakeCondition.notify_one();
+
+	return result;
+}
+
+/**
+ * Run queued loads until the one we want is done, only sleeping when there is nothing to help with
+ */
+void AssetLoader::Wait(const std::shared_future<void>& result)
+{
+	while(result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	{
+		if(!RunOne())
+			result.wait_for(std::chrono::milliseconds(1));
+	}
+
+	result.get();
+}
+
+/**
+ * Take the oldest queued load and run it, false if there wasn't one
+ */
+bool AssetLoader::RunOne()
+{
+	std::packaged_task<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(tasks.empty())
+			return false;
+
+		task = std::move(tasks.front());
+		tasks.pop_front();
+	}
+
+	task();
+	QueueReadyLoads();
+	return true;
+}
+
+/**
+ * Move held back loads whose prerequisites have finished onto the queue
+ */
+void AssetLoader::QueueReadyLoads()
+{
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i = 0; i < deferred.size();)
+		{
+			if(deferred[i].first.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				tasks.push_back(std::move(deferred[i].second));
+				deferred.erase(deferred.begin() + i);
+				queued = true;
+			}
+			else
+				++i;
+		}
+	}
+
+	if(queued)
+		wakeCondition.notify_all();
+}
+
+/**
+ * Sleep until there is something to load
+ */
+void AssetLoader::WorkerLoop()
+{
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if(stopping && tasks.empty())
+				return;
+		}
+
+		RunOne();
+	}
+}
@@ -0,0 +1,65 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_ASSETLOADER_H
+#define ARGOS3_BULLET_ASSETLOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A process wide queue of threads which load assets (definitions, meshes, decompositions...) in the
+ * background. Loads are handed out as shared futures so any number of users can wait on the same one.
+ * Waiting through Wait runs other queued loads in the meantime, so a load which waits can end up paused
+ * beneath any other. A load which other loads wait on must never wait itself, anything needing another
+ * load first is queued with SubmitAfter instead.
+ */
+class AssetLoader
+{
+public:
+	static AssetLoader& GetInstance();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	/**
+	 * Queue a load, its result becomes ready once it has run
+	 */
+	std::shared_future<void> Submit(std::function<void()> task);
+
+	/**
+	 * Queue a load once another has finished (or failed, get on the prerequisite rethrows what it threw)
+	 */
+	std::shared_future<void> SubmitAfter(const std::shared_future<void>& prerequisite, std::function<void()> task);
+
+	/**
+	 * Wait for a load to finish, helping with queued loads until it does. Rethrows anything the load threw.
+	 */
+	void Wait(const std::shared_future<void>& result);
+
+private:
+	AssetLoader();
+	~AssetLoader();
+
+	bool RunOne();
+	void QueueReadyLoads();
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;			// Signalled when a load is queued or the loader stops
+	std::deque<std::packaged_task<void()>> tasks;	// Loads nobody has started yet
+
+	// Loads held back until the load paired with them has finished
+	std::vector<std::pair<std::shared_future<void>, std::packaged_task<void()>>> deferred;
+	bool stopping{false};
+};
+
+#endif //ARGOS3_BULLET_ASSETLOADER_H
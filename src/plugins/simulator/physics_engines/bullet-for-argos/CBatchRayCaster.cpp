@@ -0,0 +1,234 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CBatchRayCaster.h"
+
+#include <utility>
+
+/**
+ * Packets are handed to threads in chunks of this size
+ */
+static const int PACKETS_PER_TASK = 4;
+
+/**
+ * Below this many packets waking the workers costs more than it saves
+ */
+static const int MIN_PARALLEL_PACKETS = 16;
+
+/**
+ * Records the nearest hit reported by the narrowphase for a single ray and object
+ */
+struct SNearestHitCallback : public btCollisionWorld::RayResultCallback
+{
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace) override
+	{
+		m_collisionObject = rayResult.m_collisionObject;
+		m_closestHitFraction = rayResult.m_hitFraction;
+		return m_closestHitFraction;
+	}
+};
+
+/**
+ * Remember where we are casting into
+ */
+CBatchRayCaster::CBatchRayCaster(btDbvtBroadphase& broadphase, WorkerPool* pool)
+		: broadphase(&broadphase), pool(pool)
+{
+}
+
+/**
+ * Group the rays into packets and cast them, across the pool if there are enough of them
+ */
+void CBatchRayCaster::CastRays(const btVector3* from, const btVector3* to, int count, SRayResult* results) const
+{
+	int numPackets = (count + PACKET_SIZE - 1) / PACKET_SIZE;
+	btAlignedObjectArray<SRayPacket> packets;
+	packets.resize(numPackets);
+
+	for(int p = 0; p < numPackets; ++p)
+	{
+		SRayPacket& packet = packets[p];
+		int first = p * PACKET_SIZE;
+		packet.count = btMin(PACKET_SIZE, count - first);
+		packet.results = results + first;
+
+		for(int i = 0; i < packet.count; ++i)
+		{
+			btVector3 direction = to[first + i] - from[first + i];
+			packet.from[i] = from[first + i];
+			packet.to[i] = to[first + i];
+			packet.length[i] = direction.length();
+			packet.results[i] = SRayResult{nullptr, btScalar(1)};
+
+			if(packet.length[i] > SIMD_EPSILON)
+				direction /= packet.length[i];
+
+			// Same precomputation as btCollisionWorld::rayTest
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				packet.inverseDirection[i][axis] = direction[axis] == btScalar(0) ? btScalar(BT_LARGE_FLOAT) : btScalar(1) / direction[axis];
+				packet.signs[i][axis] = packet.inverseDirection[i][axis] < btScalar(0);
+			}
+		}
+	}
+
+	if(!pool || numPackets < MIN_PARALLEL_PACKETS)
+	{
+		for(int p = 0; p < numPackets; ++p)
+			CastPacket(packets[p]);
+		return;
+	}
+
+	int numTasks = (numPackets + PACKETS_PER_TASK - 1) / PACKETS_PER_TASK;
+	pool->ParallelFor(numTasks, [&](int task, unsigned int threadIndex)
+	{
+		int end = btMin(numPackets, (task + 1) * PACKETS_PER_TASK);
+		for(int p = task * PACKETS_PER_TASK; p < end; ++p)
+			CastPacket(packets[p]);
+	});
+}
+
+/**
+ * Walk both of the broadphase's trees with a single ray
+ */
+void CBatchRayCaster::CastRay(const btVector3& from, const btVector3& to, btCollisionWorld::RayResultCallback& callback) const
+{
+	TraverseTree(broadphase->m_sets[0].m_root, from, to, callback);
+	TraverseTree(broadphase->m_sets[1].m_root, from, to, callback);
+}
+
+/**
+ * Walk both of the broadphase's trees with a packet
+ */
+void CBatchRayCaster::CastPacket(SRayPacket& packet) const
+{
+	TraverseTree(broadphase->m_sets[0].m_root, packet);
+	TraverseTree(broadphase->m_sets[1].m_root, packet);
+}
+
+/**
+ * Depth first walk of the tree, carrying a mask of the rays still interested in each subtree
+ */
+void CBatchRayCaster::TraverseTree(const btDbvtNode* root, SRayPacket& packet) const
+{
+	if(!root)
+		return;
+
+	// Local stack so concurrent queries never share state
+	btAlignedObjectArray<std::pair<const btDbvtNode*, unsigned int>> stack;
+	stack.push_back(std::make_pair(root, (1u << packet.count) - 1));
+
+	while(stack.size())
+	{
+		const btDbvtNode* node = stack[stack.size() - 1].first;
+		unsigned int mask = stack[stack.size() - 1].second;
+		stack.pop_back();
+
+		btVector3 bounds[2] = {node->volume.Mins(), node->volume.Maxs()};
+
+		// Which of the rays reach this node before their current closest hit?
+		unsigned int hitMask = 0;
+		for(int i = 0; i < packet.count; ++i)
+		{
+			if(!(mask & (1u << i)))
+				continue;
+
+			btScalar tmin = 1;
+			if(btRayAabb2(packet.from[i], packet.inverseDirection[i], packet.signs[i], bounds, tmin, 0,
+						  packet.results[i].fraction * packet.length[i]))
+				hitMask |= 1u << i;
+		}
+
+		if(!hitMask)
+			continue;
+
+		if(node->isinternal())
+		{
+			stack.push_back(std::make_pair(node->childs[0], hitMask));
+			stack.push_back(std::make_pair(node->childs[1], hitMask));
+			continue;
+		}
+
+		// Anything without a model (the ground) is not something we report
+		btCollisionObject* object = static_cast<btCollisionObject*>(static_cast<btBroadphaseProxy*>(node->data)->m_clientObject);
+		if(!object->getUserPointer())
+			continue;
+
+		for(int i = 0; i < packet.count; ++i)
+		{
+			if(!(hitMask & (1u << i)))
+				continue;
+
+			btTransform fromTransform{btQuaternion::getIdentity(), packet.from[i]};
+			btTransform toTransform{btQuaternion::getIdentity(), packet.to[i]};
+
+			SNearestHitCallback callback;
+			callback.m_closestHitFraction = packet.results[i].fraction;
+
+			btCollisionWorld::rayTestSingle(fromTransform, toTransform, object, object->getCollisionShape(),
+											object->getWorldTransform(), callback);
+
+			if(callback.hasHit())
+				packet.results[i] = SRayResult{object, callback.m_closestHitFraction};
+		}
+	}
+}
+
+/**
+ * Depth first walk of the tree for one ray, culled by whatever the callback has hit so far
+ */
+void CBatchRayCaster::TraverseTree(const btDbvtNode* root, const btVector3& from, const btVector3& to,
+								   btCollisionWorld::RayResultCallback& callback) const
+{
+	if(!root)
+		return;
+
+	btVector3 direction = to - from;
+	btScalar length = direction.length();
+	if(length > SIMD_EPSILON)
+		direction /= length;
+
+	// Same precomputation as btCollisionWorld::rayTest
+	btVector3 inverseDirection;
+	unsigned int signs[3];
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		inverseDirection[axis] = direction[axis] == btScalar(0) ? btScalar(BT_LARGE_FLOAT) : btScalar(1) / direction[axis];
+		signs[axis] = inverseDirection[axis] < btScalar(0);
+	}
+
+	btTransform fromTransform{btQuaternion::getIdentity(), from};
+	btTransform toTransform{btQuaternion::getIdentity(), to};
+
+	// Local stack so concurrent queries never share state
+	btAlignedObjectArray<const btDbvtNode*> stack;
+	stack.push_back(root);
+
+	while(stack.size())
+	{
+		const btDbvtNode* node = stack[stack.size() - 1];
+		stack.pop_back();
+
+		btVector3 bounds[2] = {node->volume.Mins(), node->volume.Maxs()};
+		btScalar tmin = 1;
+		if(!btRayAabb2(from, inverseDirection, signs, bounds, tmin, 0, callback.m_closestHitFraction * length))
+			continue;
+
+		if(node->isinternal())
+		{
+			stack.push_back(node->childs[0]);
+			stack.push_back(node->childs[1]);
+			continue;
+		}
+
+		// Anything without a model (the ground) is not something we report
+		btBroadphaseProxy* proxy = static_cast<btBroadphaseProxy*>(node->data);
+		btCollisionObject* object = static_cast<btCollisionObject*>(proxy->m_clientObject);
+		if(!object->getUserPointer() || !callback.needsCollision(proxy))
+			continue;
+
+		btCollisionWorld::rayTestSingle(fromTransform, toTransform, object, object->getCollisionShape(),
+										object->getWorldTransform(), callback);
+	}
+}
@@ -0,0 +1,69 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CBATCHRAYCASTER_H
+#define ARGOS3_BULLET_CBATCHRAYCASTER_H
+
+#include "./bullet/src/btBulletCollisionCommon.h"
+#include "WorkerPool.h"
+
+/**
+ * Casts many rays through a dbvt broadphase at once, as used by proximity rings and lidars.
+ *
+ * Consecutive rays are grouped into packets which walk the tree together: a node is only
+ * visited once for the whole packet and only the rays which hit it carry on to its children.
+ * Each ray remembers its closest hit so far and uses it to cull the rest of the traversal.
+ * Packets are independent so large batches are spread across the worker pool.
+ *
+ * Only objects with a user pointer (ARGoS models) are reported. Queries only read the world
+ * so any number may run at once, but not while the world is stepping. btCollisionWorld::rayTest
+ * shares a traversal stack inside the broadphase so single rays have to come through here too.
+ */
+class CBatchRayCaster
+{
+public:
+	/**
+	 * Closest object hit by a single ray, object is null if nothing was hit
+	 */
+	struct SRayResult
+	{
+		const btCollisionObject* object;
+		btScalar fraction;
+	};
+
+	static const int PACKET_SIZE = 4;
+
+	CBatchRayCaster(btDbvtBroadphase& broadphase, WorkerPool* pool);
+
+	// Cast count rays from[i] -> to[i], writing the nearest hit of each to results[i]
+	void CastRays(const btVector3* from, const btVector3* to, int count, SRayResult* results) const;
+
+	// Cast one ray, reporting every model it hits to the callback as btCollisionWorld::rayTest would
+	void CastRay(const btVector3& from, const btVector3& to, btCollisionWorld::RayResultCallback& callback) const;
+
+private:
+	/**
+	 * Up to PACKET_SIZE rays travelling through the tree together
+	 */
+	struct SRayPacket
+	{
+		int count;
+		btVector3 from[PACKET_SIZE];
+		btVector3 to[PACKET_SIZE];
+		btVector3 inverseDirection[PACKET_SIZE];
+		unsigned int signs[PACKET_SIZE][3];
+		btScalar length[PACKET_SIZE];
+		SRayResult* results;
+	};
+
+	void CastPacket(SRayPacket& packet) const;
+	void TraverseTree(const btDbvtNode* root, SRayPacket& packet) const;
+	void TraverseTree(const btDbvtNode* root, const btVector3& from, const btVector3& to,
+					  btCollisionWorld::RayResultCallback& callback) const;
+
+	btDbvtBroadphase* broadphase;
+	WorkerPool* pool;					// May be null, in which case everything runs on the calling thread
+};
+
+#endif //ARGOS3_BULLET_CBATCHRAYCASTER_H
@@ -7,6 +7,7 @@
 
 #include "./bullet/src/btBulletDynamicsCommon.h"
 #include "transform_utils.h"
+#include "CShapeCache.h"
 
 /**
  * Creates a box to be added to the world. Created boxes have a mass and restitution of 0.5
@@ -21,7 +22,7 @@ CBulletCubeModel::CBulletCubeModel(CBulletEngine& engine, CBoxEntity& entity)
 
 	// Bullet requires boxes to be initialised with half side lengths
 	CVector3 dims = entity.GetSize() * 0.5 * engine.worldScale;
-	collisionShape = new btBoxShape{btVector3{(btScalar)dims.GetX(), (btScalar)dims.GetY(), (btScalar)dims.GetZ()}};
+	collisionShape = engine.GetShapeCache().GetBox(btVector3{(btScalar)dims.GetX(), (btScalar)dims.GetY(), (btScalar)dims.GetZ()});
 
 	// Setup the location of the box in bullet compensating for the difference between ARGoS and Bullet coordinate origins
 	position = entity.GetEmbodiedEntity().GetOriginAnchor().Position;
@@ -37,7 +38,7 @@ CBulletCubeModel::CBulletCubeModel(CBulletEngine& engine, CBoxEntity& entity)
 	collisionShape->calculateLocalInertia(mass, inertia);
 
 	rigidBody = new btRigidBody{mass, motionState, collisionShape, inertia};
-	rigidBody->setActivationState(DISABLE_DEACTIVATION);
+	engine.ConfigureActivation(*rigidBody);
 
 	rigidBody->setFriction(0.5);
 	rigidBody->setRestitution(0.5);
@@ -76,8 +77,17 @@ bool CBulletCubeModel::CheckIntersectionWithRay(Real &f_t_on_ray, const CRay3 &r
  */
 void CBulletCubeModel::UpdateFromEntityStatus()
 {
-	position = entity->GetEmbodiedEntity().GetOriginAnchor().Position + rotateARGoSVector(positionOffset, orientation);
-	orientation = entity->GetEmbodiedEntity().GetOriginAnchor().Orientation;
+	const SAnchor& anchor = entity->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceAt(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Move the body to where the given anchor pose puts it
+ */
+void CBulletCubeModel::PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation)
+{
+	orientation = anchorOrientation;
+	position = anchorPosition + rotateARGoSVector(positionOffset, orientation);
 	rigidBody->setWorldTransform(bulletTransformFromARGoS(position*engine->worldScale, orientation));
 }
 
@@ -28,6 +28,7 @@ public:
 
 	// To keep the worlds in sync
 	virtual void UpdateFromEntityStatus() override;
+	virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) override;
 	virtual void UpdateEntityStatus() override;
 
 	// Execute physics
@@ -9,6 +9,7 @@
 #include "CBulletModel.h"
 
 #include "transform_utils.h"
+#include "CShapeCache.h"
 
 /**
  * Constructor for bullet cylinders. Friction and restitution both set to 0.5
@@ -23,7 +24,7 @@ CBulletCylinderModel::CBulletCylinderModel(CBulletEngine &engine, CCylinderEntit
 	// Bullet requires boxes to be initialised with half side lengths
 	btVector3 size{(btScalar)entity.GetRadius(), (btScalar)entity.GetRadius(), (btScalar)entity.GetHeight() * 0.5f};
 	size *= engine.worldScale;
-	collisionShape = new btCylinderShapeZ{size};
+	collisionShape = engine.GetShapeCache().GetCylinderZ(size);
 
 	// Setup the location of the box in bullet compensating for the difference between ARGoS and Bullet coordinate origins
 	position = entity.GetEmbodiedEntity().GetOriginAnchor().Position;
@@ -39,7 +40,7 @@ CBulletCylinderModel::CBulletCylinderModel(CBulletEngine &engine, CCylinderEntit
 	collisionShape->calculateLocalInertia(mass, inertia);
 
 	rigidBody = new btRigidBody{mass, motionState, collisionShape, inertia};
-	rigidBody->setActivationState(DISABLE_DEACTIVATION);
+	engine.ConfigureActivation(*rigidBody);
 
 	rigidBody->setFriction(0.5);
 	rigidBody->setRestitution(0.5);
@@ -52,9 +53,18 @@ CBulletCylinderModel::CBulletCylinderModel(CBulletEngine &engine, CCylinderEntit
  */
 void CBulletCylinderModel::UpdateFromEntityStatus()
 {
-	position = entity->GetEmbodiedEntity().GetOriginAnchor().Position + rotateARGoSVector(positionOffset, orientation);
+	const SAnchor& anchor = entity->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceAt(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Move the body to where the given anchor pose puts it
+ */
+void CBulletCylinderModel::PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation)
+{
+	orientation = anchorOrientation;
+	position = anchorPosition + rotateARGoSVector(positionOffset, orientation);
 	position *= engine->worldScale;
-	orientation = entity->GetEmbodiedEntity().GetOriginAnchor().Orientation;
 	rigidBody->setWorldTransform(bulletTransformFromARGoS(position, orientation));
 }
 
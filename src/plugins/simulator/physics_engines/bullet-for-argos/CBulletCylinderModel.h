@@ -26,6 +26,7 @@ public:
 
 	// Keep the worlds in sync
 	virtual void UpdateFromEntityStatus() override;
+	virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) override;
 	virtual void UpdateEntityStatus() override;
 
 	// Update the world
@@ -5,54 +5,401 @@
 
 #include "./bullet/src/btBulletDynamicsCommon.h"
 #include "CBulletEngine.h"
+#include "CBatchRayCaster.h"
+#include "CBulletMultibodyLink.h"
+#include "CParallelCollisionDispatcher.h"
+#include "CParallelDynamicsWorld.h"
+#include "CShapeCache.h"
+#include "CStepProfiler.h"
+#include "CWorldSnapshot.h"
+#include "WorldCheckpoint.h"
+#include "AssetCache.h"
+#include "MultibodyEntityDatabase.h"
 #include "NumericalHelpers.h"
 #include "StringFuncs.h"
 
 #include "BulletCollision/Gimpact/btGImpactCollisionAlgorithm.h"
+#include "BulletDynamics/Featherstone/btMultiBody.h"
+#include "BulletDynamics/Featherstone/btMultiBodyConstraint.h"
+#include "BulletDynamics/Featherstone/btMultiBodyConstraintSolver.h"
+#include "BulletDynamics/Featherstone/btMultiBodyDynamicsWorld.h"
+#include "BulletDynamics/Featherstone/btMultiBodyLinkCollider.h"
+
+#include <argos3/core/simulator/simulator.h>
+
+#include <algorithm>
+#include <iostream>
 
 /**
- * Setup a bullet world
+ * Setup the collision handling, the dispatcher and world are created in Init once we know which type is wanted
  */
-CBulletEngine::CBulletEngine()
+CBulletEngine::CBulletEngine() : collisionDispatcher(nullptr), solver(nullptr), dynamicsWorld(nullptr),
+								 multiBodyWorld(nullptr), workerPool(nullptr)
 {
+	// Entities fetch their shapes from here, every engine in the process uses the same shapes
+	shapeCache = CShapeCache::GetShared();
+	snapshot = new CWorldSnapshot;
+
 	// Basic collision handling
 	collisionConfiguration = new btDefaultCollisionConfiguration;
-	collisionDispatcher = new btCollisionDispatcher {collisionConfiguration};
-	btGImpactCollisionAlgorithm::registerAlgorithm(collisionDispatcher);
 
 	// Dynamics solver setup
 	overlappingPairCache = new btDbvtBroadphase;
-	solver = new btSequentialImpulseConstraintSolver;
-	dynamicsWorld = new btDiscreteDynamicsWorld {collisionDispatcher, overlappingPairCache, solver,
-												 collisionConfiguration};
+}
+
+/**
+ * Create the dispatcher, solver and dynamics world, running the narrowphase and solving islands across a worker
+ * pool or supporting btMultiBody if requested, and add the ground to it
+ */
+void CBulletEngine::CreateWorld(bool parallel, unsigned int numThreads)
+{
+	if(featherstone)
+	{
+		if(parallel)
+			THROW_ARGOSEXCEPTION("Featherstone multibodies need the \"discrete\" bullet world");
+
+		collisionDispatcher = new btCollisionDispatcher {collisionConfiguration};
+		btGImpactCollisionAlgorithm::registerAlgorithm(collisionDispatcher);
+
+		btMultiBodyConstraintSolver* multiBodySolver = new btMultiBodyConstraintSolver;
+		solver = multiBodySolver;
+		multiBodyWorld = new btMultiBodyDynamicsWorld {collisionDispatcher, overlappingPairCache, multiBodySolver,
+													   collisionConfiguration};
+		dynamicsWorld = multiBodyWorld;
+	}
+	else if(parallel)
+	{
+		workerPool = new WorkerPool{numThreads};
+		CParallelCollisionDispatcher* parallelDispatcher = new CParallelCollisionDispatcher {collisionConfiguration, *workerPool};
+		parallelDispatcher->SetDeterministic(deterministic);
+		collisionDispatcher = parallelDispatcher;
+		btGImpactCollisionAlgorithm::registerAlgorithm(collisionDispatcher);
+
+		solver = new btSequentialImpulseConstraintSolver;
+		CParallelDynamicsWorld* parallelWorld = new CParallelDynamicsWorld {collisionDispatcher, overlappingPairCache, solver,
+																			 collisionConfiguration, *workerPool};
+		parallelWorld->SetDeterministic(deterministic);
+		dynamicsWorld = parallelWorld;
+	}
+	else
+	{
+		collisionDispatcher = new btCollisionDispatcher {collisionConfiguration};
+		btGImpactCollisionAlgorithm::registerAlgorithm(collisionDispatcher);
+
+		solver = new btSequentialImpulseConstraintSolver;
+		dynamicsWorld = new btDiscreteDynamicsWorld {collisionDispatcher, overlappingPairCache, solver,
+													 collisionConfiguration};
+	}
 
 	btStaticPlaneShape* groundShape = new btStaticPlaneShape{btVector3{0, 0, 1}, 0};
+	collisionShapes.push_back(groundShape);
+
 	btRigidBody* groundBody = new btRigidBody{0, new btDefaultMotionState, groundShape};
-	groundBody->setActivationState(DISABLE_DEACTIVATION);
 	groundBody->setFriction(0.8);
 	groundBody->setRestitution(0.8);
 
 	dynamicsWorld->addRigidBody(groundBody, GetObjectGroup(true), GetObjectCollisionFlags(true));
-	
-	// Gravity in Z
-	dynamicsWorld->setGravity(btVector3{0, 0, -9.81f});
 }
 
 /**
- * Perform physics tick and sync bullet and ARGoS
+ * Perform physics tick and sync bullet and ARGoS, timing each phase if profiling
  */
 void CBulletEngine::Update()
 {
-	// Update physics model from ARGoS entity
-	for(auto it = entityMap.begin(); it != entityMap.end(); ++it)
-		it->second->UpdateFromEntityStatus();
+	if(!profiler)
+	{
+		UpdateWorld();
+		return;
+	}
+
+	profiler->BeginTick();
+	UpdateWorld();
+	profiler->EndTick(CSimulator::GetInstance().GetSpace().GetSimulationClock());
+}
+
+/**
+ * Push what ARGoS changed, step and write back what bullet moved. Each phase is a profile sample so it shows up
+ * next to bullet's own phases.
+ */
+void CBulletEngine::UpdateWorld()
+{
+	// Update physics models which ARGoS moved since the last tick
+	{
+		BT_PROFILE("pushDirty");
+		for(int index : dirtyRecords)
+			PushIfDirty(*syncRecords[index].model);
+		dirtyRecords.clear();
+	}
+
+	// Everything is where the experiment starts it, remember that for Reset
+	if(!snapshot->IsCaptured())
+	{
+		BT_PROFILE("captureSnapshot");
+		snapshot->Capture(*dynamicsWorld, multiBodyWorld, *static_cast<btDbvtBroadphase*>(overlappingPairCache));
+		for(auto& record : syncRecords)
+			record.restorable = true;
+	}
+
+	// Carry on from where a previous run left off, the tick it was written on has already been simulated
+	if(resumePending)
+	{
+		BT_PROFILE("loadCheckpoint");
+		resumePending = false;
+		if(LoadCheckpoint(checkpointFile))
+			return;
+	}
+
+	// Motors pick up their targets every tick
+	{
+		BT_PROFILE("pushMotors");
+		for(auto model : perTickModels)
+			model->UpdateFromEntityStatus();
+	}
 
 	// Simulate the physics
 	dynamicsWorld->stepSimulation((float) GetSimulationClockTick(), maxTicks, internalTimeStep);
 
-	// Update entityMap from physics model
-	for(auto it = entityMap.begin(); it != entityMap.end(); ++it)
-		it->second->UpdateEntityStatus();
+	// Only bodies bullet could have moved need writing back
+	{
+		BT_PROFILE("writeBack");
+		for(auto& record : syncRecords)
+		{
+			if(!record.dynamic)
+				continue;
+
+			bool active = record.object->isActive();
+			record.moved = active || record.awake;
+			if(record.moved)
+				record.model->UpdateEntityStatus();
+			record.awake = active;
+		}
+
+		for(auto model : perTickModels)
+			model->UpdateEntityStatus();
+	}
+
+	// Anything which left our part of the arena is handed over once every engine has stepped
+	if(hasRegion)
+	{
+		BT_PROFILE("findTransfers");
+		FindTransfers();
+	}
+
+	if(checkpointInterval > 0 && CSimulator::GetInstance().GetSpace().GetSimulationClock() % checkpointInterval == 0)
+	{
+		BT_PROFILE("saveCheckpoint");
+		SaveCheckpoint(checkpointFile);
+	}
+}
+
+/**
+ * Put the world back as it was before the first step in one go, then bring ARGoS in line with it. Anything added
+ * since then is pushed from ARGoS instead, as are static bodies and anything ARGoS has moved since the last step.
+ */
+void CBulletEngine::Reset()
+{
+	CPhysicsEngine::Reset();
+
+	if(snapshot->IsCaptured())
+	{
+		ResetSolverState();
+		snapshot->Restore(*dynamicsWorld, multiBodyWorld, *static_cast<btDbvtBroadphase*>(overlappingPairCache));
+	}
+
+	for(int i = 0; i < (int)syncRecords.size(); ++i)
+	{
+		SSyncRecord& record = syncRecords[i];
+		if(record.dirty)
+			continue;
+
+		if(record.restorable && record.dynamic && snapshot->IsCaptured())
+		{
+			record.model->UpdateEntityStatus();
+			record.awake = true;
+		}
+		else
+		{
+			record.dirty = true;
+			dirtyRecords.push_back(i);
+		}
+	}
+
+	for(auto model : perTickModels)
+		model->UpdateEntityStatus();
+
+	// Every dynamic body is written back after the next step so all of them are checked against the region again
+	pendingTransfers.clear();
+}
+
+/**
+ * Write the world, model state and clock to a checkpoint. A resumed run starts without any contacts or warm
+ * starting, so they are dropped here too to keep this run the same as one resumed from here.
+ */
+bool CBulletEngine::SaveCheckpoint(const std::string& file)
+{
+	// Anything ARGoS has moved belongs in the checkpoint
+	for(int index : dirtyRecords)
+		PushIfDirty(*syncRecords[index].model);
+	dirtyRecords.clear();
+
+	bool written = writeCheckpoint(file, *dynamicsWorld, multiBodyWorld, entityMap,
+								   CSimulator::GetInstance().GetSpace().GetSimulationClock());
+	if(!written)
+		std::cerr << "Unable to write bullet checkpoint \"" << file << "\"" << std::endl;
+
+	ResetSolverState();
+	CWorldSnapshot::RebuildBroadphase(*dynamicsWorld, *static_cast<btDbvtBroadphase*>(overlappingPairCache));
+	return written;
+}
+
+/**
+ * Put the world, models and clock back as a checkpoint has them, then bring ARGoS in line. Static bodies were
+ * placed by the experiment so are left as they are.
+ */
+bool CBulletEngine::LoadCheckpoint(const std::string& file)
+{
+	uint32_t clock;
+	if(!readCheckpoint(file, *dynamicsWorld, multiBodyWorld, entityMap, clock))
+		return false;
+
+	ResetSolverState();
+	CWorldSnapshot::RebuildBroadphase(*dynamicsWorld, *static_cast<btDbvtBroadphase*>(overlappingPairCache));
+	CSimulator::GetInstance().GetSpace().SetSimulationClock(clock);
+
+	for(auto& record : syncRecords)
+	{
+		if(!record.dynamic)
+			continue;
+
+		// The checkpoint wins over anything ARGoS moved beforehand
+		record.dirty = false;
+		record.model->UpdateEntityStatus();
+		record.awake = true;
+	}
+
+	for(auto model : perTickModels)
+		model->UpdateEntityStatus();
+
+	return true;
+}
+
+/**
+ * Clear what the solvers carry from one step to the next
+ */
+void CBulletEngine::ResetSolverState()
+{
+	solver->reset();
+	if(CParallelDynamicsWorld* parallelWorld = dynamic_cast<CParallelDynamicsWorld*>(dynamicsWorld))
+		parallelWorld->ResetSolvers();
+}
+
+/**
+ * Push a model straight away if it has been moved. It may stay in the dirty list but won't be pushed twice.
+ */
+void CBulletEngine::PushIfDirty(const CBulletModel& model)
+{
+	if(model.syncIndex < 0 || !syncRecords[model.syncIndex].dirty)
+		return;
+
+	CBulletModel& pushed = *syncRecords[model.syncIndex].model;
+	pushed.UpdateFromEntityStatus();
+	MarkPlaced(pushed);
+}
+
+/**
+ * Clear a model's dirty flag once its body is where ARGoS wants it
+ */
+void CBulletEngine::MarkPlaced(CBulletModel& model)
+{
+	if(model.syncIndex < 0)
+		return;
+
+	SSyncRecord& record = syncRecords[model.syncIndex];
+	record.dirty = false;
+
+	// Teleported bodies need simulating again, as does anything they now touch
+	if(record.dynamic)
+	{
+		record.object->activate(true);
+		record.awake = true;
+	}
+}
+
+/**
+ * Either disable sleeping entirely or set the thresholds below which a body may sleep
+ */
+void CBulletEngine::ConfigureActivation(btRigidBody& body) const
+{
+	if(!deactivation)
+	{
+		body.setActivationState(DISABLE_DEACTIVATION);
+		return;
+	}
+
+	body.setSleepingThresholds(linearSleepThreshold*worldScale, angularSleepThreshold);
+}
+
+/**
+ * btMultiBody sleeps as a whole when the sum of its squared velocities stays low, so the thresholds are combined
+ * to match what a rigid body resting at both of them would give. Colliders never sleep if deactivation is off.
+ */
+void CBulletEngine::ConfigureActivation(btMultiBody& multiBody) const
+{
+	btScalar linearThreshold = linearSleepThreshold*worldScale;
+	multiBody.setCanSleep(deactivation);
+	multiBody.setSleepTimeout(deactivationTime);
+	multiBody.setSleepThreshold(linearThreshold*linearThreshold + angularSleepThreshold*angularSleepThreshold);
+
+	if(deactivation)
+		return;
+
+	if(multiBody.getBaseCollider())
+		multiBody.getBaseCollider()->setActivationState(DISABLE_DEACTIVATION);
+	for(int i = 0; i < multiBody.getNumLinks(); ++i)
+		if(multiBody.getLink(i).m_collider)
+			multiBody.getLink(i).m_collider->setActivationState(DISABLE_DEACTIVATION);
+}
+
+/**
+ * Queue a model to be pushed to bullet before the next step
+ */
+void CBulletEngine::MarkDirty(CBulletModel& model)
+{
+	// Models without a record are synced every tick anyway
+	if(model.syncIndex < 0 || syncRecords[model.syncIndex].dirty)
+		return;
+
+	syncRecords[model.syncIndex].dirty = true;
+	dirtyRecords.push_back(model.syncIndex);
+}
+
+/**
+ * Remove a constraint a model added and delete it
+ */
+void CBulletEngine::DestroyConstraint(btTypedConstraint* constraint)
+{
+	dynamicsWorld->removeConstraint(constraint);
+	snapshot->Forget(constraint);
+	delete constraint;
+}
+
+/**
+ * Remove a multibody constraint (motor or limit) and delete it, snapshots don't track these
+ */
+void CBulletEngine::DestroyMultiBodyConstraint(btMultiBodyConstraint* constraint)
+{
+	multiBodyWorld->removeMultiBodyConstraint(constraint);
+	delete constraint;
+}
+
+/**
+ * Remove a btMultiBody and delete it, its link colliders are removed separately by their models
+ */
+void CBulletEngine::DestroyMultiBody(btMultiBody* multiBody)
+{
+	multiBodyWorld->removeMultiBody(multiBody);
+	snapshot->Forget(multiBody);
+	delete multiBody;
 }
 
 /**
@@ -65,12 +412,136 @@ void CBulletEngine::Init(TConfigurationNode &t_tree)
 	maxTicks = GetIterations();
 	internalTimeStep = GetSimulationClockTick()/maxTicks;
 
+	// Which kind of world should we build?
+	std::string worldType = t_tree.GetAttributeOrDefault("world", "discrete");
+	unsigned int numThreads;
+	extractFromString(t_tree.GetAttributeOrDefault("threads", "0"), numThreads);
+
+	// Multibodies are hinged rigid bodies unless reduced coordinates are asked for, which needs a different world
+	std::string multibodyType = t_tree.GetAttributeOrDefault("multibody", "constraints");
+	if(multibodyType == "featherstone")
+		featherstone = true;
+	else if(multibodyType != "constraints")
+		THROW_ARGOSEXCEPTION("Unknown bullet multibody type \"" << multibodyType << "\", expected \"constraints\" or \"featherstone\"");
+
+	// Parallel worlds can give identical results for any thread count at the cost of sorting pairs and manifolds
+	std::string deterministicMode = t_tree.GetAttributeOrDefault("deterministic", "false");
+	if(deterministicMode == "true")
+		deterministic = true;
+	else if(deterministicMode != "false")
+		THROW_ARGOSEXCEPTION("Invalid bullet deterministic setting \"" << deterministicMode << "\", expected \"true\" or \"false\"");
+
+	if(worldType == "parallel")
+		CreateWorld(true, numThreads);
+	else if(worldType == "discrete")
+		CreateWorld(false, 0);
+	else
+		THROW_ARGOSEXCEPTION("Unknown bullet world type \"" << worldType << "\", expected \"discrete\" or \"parallel\"");
+
 	extractFromString(t_tree.GetAttributeOrDefault("world_scale", "1"), worldScale);
 	worldScaleSquared = worldScale*worldScale;
 	inverseWorldScale = 1/worldScale;
 	inverseWorldScaleSquared = 1/worldScaleSquared;
 	dynamicsWorld->setGravity(btVector3{0, 0, -9.81}*worldScale);
 
+	// Resting bodies are put to sleep unless asked otherwise
+	std::string deactivationMode = t_tree.GetAttributeOrDefault("deactivation", "true");
+	if(deactivationMode == "true")
+		deactivation = true;
+	else if(deactivationMode == "false")
+		deactivation = false;
+	else
+		THROW_ARGOSEXCEPTION("Invalid bullet deactivation setting \"" << deactivationMode << "\", expected \"true\" or \"false\"");
+
+	extractFromString(t_tree.GetAttributeOrDefault("linear_sleep_threshold", "0.8"), linearSleepThreshold);
+	extractFromString(t_tree.GetAttributeOrDefault("angular_sleep_threshold", "1.0"), angularSleepThreshold);
+
+	// Bullet only has one deactivation time for every world, so every engine in the process has to agree on it
+	extractFromString(t_tree.GetAttributeOrDefault("deactivation_time", "2.0"), deactivationTime);
+	for(CPhysicsEngine* other : CSimulator::GetInstance().GetPhysicsEngines())
+	{
+		CBulletEngine* otherEngine = dynamic_cast<CBulletEngine*>(other);
+		if(otherEngine && otherEngine != this && otherEngine->deactivationTime != deactivationTime)
+			THROW_ARGOSEXCEPTION("Bullet engine \"" << GetId() << "\" has a deactivation time of " << deactivationTime
+								 << " but \"" << otherEngine->GetId() << "\" has " << otherEngine->deactivationTime
+								 << ", every bullet engine must use the same one");
+	}
+	gDeactivationTime = deactivationTime;
+
+	// Link cylinders are exact unless hulls are wanted for their contact behaviour
+	std::string cylinderShape = t_tree.GetAttributeOrDefault("cylinder_shape", "analytic");
+	if(cylinderShape == "hull")
+		cylinderHulls = true;
+	else if(cylinderShape != "analytic")
+		THROW_ARGOSEXCEPTION("Unknown bullet cylinder shape \"" << cylinderShape << "\", expected \"analytic\" or \"hull\"");
+
+	extractFromString(t_tree.GetAttributeOrDefault("cylinder_hull_segments", "16"), cylinderHullSegments);
+	if(cylinderHullSegments < 3)
+		THROW_ARGOSEXCEPTION("Bullet cylinder hulls need at least 3 segments, got " << cylinderHullSegments);
+
+	// Link meshes are reduced to small hulls unless the raw triangles are wanted
+	std::string meshShape = t_tree.GetAttributeOrDefault("mesh_shape", "hull");
+	if(meshShape == "triangles")
+		meshHullVertices = 0;
+	else if(meshShape == "hull")
+	{
+		extractFromString(t_tree.GetAttributeOrDefault("mesh_hull_vertices", "64"), meshHullVertices);
+		if(meshHullVertices < 4)
+			THROW_ARGOSEXCEPTION("Bullet mesh hulls need at least 4 vertices, got " << meshHullVertices);
+	}
+	else
+		THROW_ARGOSEXCEPTION("Unknown bullet mesh shape \"" << meshShape << "\", expected \"hull\" or \"triangles\"");
+
+	// Long runs can write checkpoints as they go and carry on from the last one after being stopped
+	checkpointFile = t_tree.GetAttributeOrDefault("checkpoint_file", "");
+	extractFromString(t_tree.GetAttributeOrDefault("checkpoint_interval", "0"), checkpointInterval);
+	if(checkpointInterval < 0)
+		THROW_ARGOSEXCEPTION("Bullet checkpoint interval can't be negative, got " << checkpointInterval);
+
+	std::string resumeMode = t_tree.GetAttributeOrDefault("resume", "false");
+	if(resumeMode == "true")
+		resumePending = true;
+	else if(resumeMode != "false")
+		THROW_ARGOSEXCEPTION("Invalid bullet resume setting \"" << resumeMode << "\", expected \"true\" or \"false\"");
+
+	if((checkpointInterval > 0 || resumePending) && checkpointFile.empty())
+		THROW_ARGOSEXCEPTION("Bullet checkpoints need a checkpoint_file");
+
+	// Engines can share the arena, each simulating the box between its region corners
+	GetNodeAttributeOrDefault(t_tree, "region_min", regionMin, regionMin);
+	GetNodeAttributeOrDefault(t_tree, "region_max", regionMax, regionMax);
+	hasRegion = NodeAttributeExists(t_tree, "region_min") || NodeAttributeExists(t_tree, "region_max");
+	if(regionMin.GetX() >= regionMax.GetX() || regionMin.GetY() >= regionMax.GetY() || regionMin.GetZ() >= regionMax.GetZ())
+		THROW_ARGOSEXCEPTION("Bullet engine \"" << GetId() << "\" has an empty region, from " << regionMin << " to " << regionMax);
+
+	// Time every phase of each tick, bullet's profile tree is shared so only one engine can be profiled
+	std::string profileMode = t_tree.GetAttributeOrDefault("profile", "false");
+	if(profileMode == "true")
+	{
+		for(CPhysicsEngine* other : CSimulator::GetInstance().GetPhysicsEngines())
+		{
+			CBulletEngine* otherEngine = dynamic_cast<CBulletEngine*>(other);
+			if(otherEngine && otherEngine != this && otherEngine->profiler)
+				THROW_ARGOSEXCEPTION("Bullet engine \"" << GetId() << "\" can't be profiled as \"" << otherEngine->GetId()
+									 << "\" already is, only one bullet engine can be profiled at a time");
+		}
+
+		int profileInterval;
+		extractFromString(t_tree.GetAttributeOrDefault("profile_interval", "0"), profileInterval);
+		if(profileInterval < 0)
+			THROW_ARGOSEXCEPTION("Bullet profile interval can't be negative, got " << profileInterval);
+
+		profiler = new CStepProfiler(t_tree.GetAttributeOrDefault("profile_file", "bullet_profile.csv"), profileInterval);
+	}
+	else if(profileMode != "false")
+		THROW_ARGOSEXCEPTION("Invalid bullet profile setting \"" << profileMode << "\", expected \"true\" or \"false\"");
+
+	// Preprocessed assets are stored next to the originals unless somewhere else is given
+	setAssetCacheDirectory(t_tree.GetAttributeOrDefault("cache_dir", ""));
+
+	// Entities are only created after the engines, start loading everything they use in the meantime
+	MultibodyEntityDatabase::getInstance().prefetchAll(&CSimulator::GetInstance().GetConfigurationRoot());
+
 //	std::cout<<"World scale = "<<worldScale<<"  Squared = "<<worldScaleSquared<<std::endl;
 }
 
@@ -79,13 +550,33 @@ void CBulletEngine::Init(TConfigurationNode &t_tree)
  */
 CBulletEngine::~CBulletEngine()
 {
-	// Delete all entities from the world
-	for(int i = dynamicsWorld->getNumCollisionObjects() - 1; i >= 0; --i)
+	// Multibodies and their motors go first, their link colliders are deleted with everything else
+	if(multiBodyWorld)
+	{
+		for(int i = multiBodyWorld->getNumMultiBodyConstraints() - 1; i >= 0; --i)
+		{
+			btMultiBodyConstraint* constraint = multiBodyWorld->getMultiBodyConstraint(i);
+			multiBodyWorld->removeMultiBodyConstraint(constraint);
+			delete constraint;
+		}
+
+		for(int i = multiBodyWorld->getNumMultibodies() - 1; i >= 0; --i)
+		{
+			btMultiBody* multiBody = multiBodyWorld->getMultiBody(i);
+			multiBodyWorld->removeMultiBody(multiBody);
+			delete multiBody;
+		}
+	}
+
+	// Delete all entities from the world, handing back their shapes as other engines may still be using the cache
+	for(int i = (dynamicsWorld ? dynamicsWorld->getNumCollisionObjects() : 0) - 1; i >= 0; --i)
 	{
 		btCollisionObject* obj = dynamicsWorld->getCollisionObjectArray()[i];
 		btRigidBody* body = btRigidBody::upcast(obj);
 		if(body && body->getMotionState())
 			delete body->getMotionState();
+		if(obj->getUserPointer())
+			shapeCache->Release(obj->getCollisionShape());
 		dynamicsWorld->removeCollisionObject(obj);
 		delete obj;
 	}
@@ -98,8 +589,16 @@ CBulletEngine::~CBulletEngine()
 		delete shape;
 	}
 
+	// Including shared ones, which are freed along with the last engine using them
+	shapeCache.reset();
+	delete snapshot;
+
+	// Writing out whatever the profiler has left
+	delete profiler;
+
 	// And any auxiliary objects
 	delete dynamicsWorld;
+	delete workerPool;
 	delete solver;
 	delete overlappingPairCache;
 	delete collisionDispatcher;
@@ -141,6 +640,24 @@ void CBulletEngine::AddPhysicsModel(const std::string &entityId, CBulletModel &m
 
 	// And let the object add itself
 	model.AddToEngine(*this);
+
+	// Let ray and contact queries find their way back to the model
+	btCollisionObject* object = model.GetCollisionObject();
+	if(object)
+		object->setUserPointer(&model);
+
+	// Then decide how it will be kept in sync with ARGoS
+	if(!model.RequiresSync())
+		return;
+
+	if(object)
+	{
+		model.syncIndex = (int)syncRecords.size();
+		syncRecords.push_back(SSyncRecord{&model, object, !object->isStaticOrKinematicObject(), true, false, false, false});
+		MarkDirty(model);
+	}
+	else
+		perTickModels.push_back(&model);
 }
 
 /**
@@ -167,7 +684,15 @@ void CBulletEngine::RemovePhysicsModel(const std::string &entityId)
 		return;
 
 
+	// Composite models take their parts and anything joining them out first
 	CBulletModel* model = it->second;
+	model->RemoveFromEngine(*this);
+
+	// Its position can't decide a transfer any more
+	pendingTransfers.erase(std::remove_if(pendingTransfers.begin(), pendingTransfers.end(),
+										  [&](const std::pair<CEntity*, CBulletModel*>& transfer) { return transfer.second == model; }),
+						   pendingTransfers.end());
+
 	for(auto vecIt = entities.begin(); vecIt < entities.end(); ++vecIt)
 	{
 		if(*vecIt == model)
@@ -177,49 +702,368 @@ void CBulletEngine::RemovePhysicsModel(const std::string &entityId)
 		}
 	}
 
-	// Not all objects have rigid bodies (actuators for example)
+	// Drop its sync record, moving the last record into its place
+	if(model->syncIndex >= 0)
+	{
+		int index = model->syncIndex;
+		int last = (int)syncRecords.size() - 1;
+
+		for(auto dirtyIt = dirtyRecords.begin(); dirtyIt != dirtyRecords.end(); )
+		{
+			if(*dirtyIt == index)
+				dirtyIt = dirtyRecords.erase(dirtyIt);
+			else
+			{
+				if(*dirtyIt == last)
+					*dirtyIt = index;
+				++dirtyIt;
+			}
+		}
+
+		syncRecords[index] = syncRecords[last];
+		syncRecords[index].model->syncIndex = index;
+		syncRecords.pop_back();
+		model->syncIndex = -1;
+	}
+	else
+	{
+		auto tickIt = std::find(perTickModels.begin(), perTickModels.end(), model);
+		if(tickIt != perTickModels.end())
+			perTickModels.erase(tickIt);
+	}
+
+	// Not all objects have rigid bodies (actuators for example), links of btMultiBody objects only have colliders
 	if(model->GetRigidBody())
 		dynamicsWorld->removeRigidBody(model->GetRigidBody());
+	else if(model->GetCollisionObject())
+		dynamicsWorld->removeCollisionObject(model->GetCollisionObject());
+
+	// Nothing else refers to the body now, so it goes along with the model
+	if(btCollisionObject* object = model->GetCollisionObject())
+	{
+		snapshot->Forget(object);
+		shapeCache->Release(object->getCollisionShape());
+
+		btRigidBody* body = btRigidBody::upcast(object);
+		if(body && body->getMotionState())
+			delete body->getMotionState();
+		delete object;
+	}
 
 	delete it->second;
 	entityMap.erase(entityId);
 }
 
 /**
- * Iterate over all objects checking for collisions and populate the provided intersection list
+ * Velocities a model had when its entity left, in bullet units of the engine it left
  */
-void CBulletEngine::CheckIntersectionWithRay(argos::TEmbodiedEntityIntersectionData& ret, const CRay3 &c_ray) const
+struct CBulletEngine::STransferredMotion
+{
+	std::string id;
+	btVector3 linearVelocity;				// Of the body, or the base of a btMultiBody
+	btVector3 angularVelocity;
+	std::vector<btScalar> jointValues;		// Joint positions then velocities of a btMultiBody, if the model is its base
+	bool multiBody;
+};
+
+/**
+ * Regions include their minimum corner but not their maximum so a point on a shared face has one owner
+ */
+bool CBulletEngine::IsPointContained(const CVector3& vec)
+{
+	return vec.GetX() >= regionMin.GetX() && vec.GetY() >= regionMin.GetY() && vec.GetZ() >= regionMin.GetZ() &&
+		   vec.GetX() < regionMax.GetX() && vec.GetY() < regionMax.GetY() && vec.GetZ() < regionMax.GetZ();
+}
+
+/**
+ * Only bodies written back this tick can have moved, so only those are checked against the region. Anything which
+ * left earlier without finding a new engine is still queued, so it is found again even once it sleeps.
+ */
+void CBulletEngine::FindTransfers()
+{
+	for(auto& record : syncRecords)
+	{
+		if(!record.dynamic || !record.moved)
+			continue;
+
+		if(IsPointContained(record.model->GetEmbodiedEntity().GetOriginAnchor().Position))
+			continue;
+
+		CEntity* entity = record.model->GetTransferEntity();
+		if(!entity)
+			continue;
+
+		auto sameEntity = [&](const std::pair<CEntity*, CBulletModel*>& transfer) { return transfer.first == entity; };
+		if(std::none_of(pendingTransfers.begin(), pendingTransfers.end(), sameEntity))
+			pendingTransfers.emplace_back(entity, record.model);
+	}
+}
+
+/**
+ * Hand every entity which has left to the engine owning where it is now. ARGoS only knows where entities are, so
+ * velocities and joint states are carried across separately when the other engine is a bullet engine too.
+ */
+void CBulletEngine::TransferEntities()
 {
-	CEmbodiedEntity* closest = nullptr;
-	Real fTOnRay;
+	std::vector<std::pair<CEntity*, CBulletModel*>> transfers;
+	transfers.swap(pendingTransfers);
 
-	for(auto& it : entityMap)
+	for(auto& transfer : transfers)
 	{
-		if(it.second->CheckIntersectionWithRay(fTOnRay, c_ray))
-			ret.push_back(SEmbodiedEntityIntersectionItem{&it.second->GetEmbodiedEntity(), fTOnRay});
+		// It may have come back since it was queued
+		const CVector3& position = transfer.second->GetEmbodiedEntity().GetOriginAnchor().Position;
+		if(IsPointContained(position))
+			continue;
+
+		CPhysicsEngine* target = nullptr;
+		for(CPhysicsEngine* engine : CSimulator::GetInstance().GetPhysicsEngines())
+		{
+			if(engine != this && engine->IsPointContained(position))
+			{
+				target = engine;
+				break;
+			}
+		}
+
+		// Nobody owns where it went so it carries on here, staying queued until it comes back or somebody does
+		if(!target)
+		{
+			pendingTransfers.push_back(transfer);
+			continue;
+		}
+
+		std::vector<STransferredMotion> motion;
+		CaptureMotion(*transfer.first, motion);
+
+		RemoveEntity(*transfer.first);
+		target->AddEntity(*transfer.first);
+
+		if(CBulletEngine* bulletTarget = dynamic_cast<CBulletEngine*>(target))
+		{
+			for(auto& state : motion)
+				state.linearVelocity *= bulletTarget->worldScale*inverseWorldScale;
+			bulletTarget->ApplyMotion(motion);
+		}
 	}
 }
 
 /**
- * Iterate over all objects checking for collisions and return the first object hit, if any
+ * Velocities of every body making up an entity, keyed by the model ids the other engine will give them
+ */
+void CBulletEngine::CaptureMotion(CEntity& entity, std::vector<STransferredMotion>& motion) const
+{
+	for(auto& pair : entityMap)
+	{
+		CBulletModel* model = pair.second;
+		if(&model->GetEmbodiedEntity().GetRootEntity() != &entity)
+			continue;
+
+		STransferredMotion state;
+		state.id = pair.first;
+		state.multiBody = false;
+
+		const CBulletMultibodyLink* link = dynamic_cast<const CBulletMultibodyLink*>(model);
+		if(link && link->GetMultiBody())
+		{
+			// Links of a btMultiBody move with its base, which carries the whole body's state
+			if(link->GetMultiBodyIndex() >= 0)
+				continue;
+
+			const btMultiBody* multiBody = link->GetMultiBody();
+			state.linearVelocity = multiBody->getBaseVel();
+			state.angularVelocity = multiBody->getBaseOmega();
+			CWorldSnapshot::CaptureMultiBody(*multiBody, state.jointValues);
+			state.multiBody = true;
+		}
+		else if(btRigidBody* body = model->GetRigidBody())
+		{
+			if(body->isStaticOrKinematicObject())
+				continue;
+
+			state.linearVelocity = body->getLinearVelocity();
+			state.angularVelocity = body->getAngularVelocity();
+		}
+		else
+			continue;
+
+		motion.push_back(state);
+	}
+}
+
+/**
+ * Place newly arrived models where ARGoS has them now, then give them back the velocities they left with
+ */
+void CBulletEngine::ApplyMotion(const std::vector<STransferredMotion>& motion)
+{
+	for(auto& state : motion)
+	{
+		CBulletModel* model = GetPhysicsModel(state.id);
+		if(!model)
+			continue;
+
+		PushIfDirty(*model);
+
+		CBulletMultibodyLink* link = dynamic_cast<CBulletMultibodyLink*>(model);
+		if(state.multiBody && link && link->GetMultiBody())
+		{
+			btMultiBody* multiBody = link->GetMultiBody();
+			CWorldSnapshot::RestoreMultiBody(*multiBody, multiBody->getBaseWorldTransform(), state.linearVelocity,
+											 state.angularVelocity, state.jointValues.data(), true);
+		}
+		else if(btRigidBody* body = model->GetRigidBody())
+		{
+			body->setLinearVelocity(state.linearVelocity);
+			body->setAngularVelocity(state.angularVelocity);
+			body->activate(true);
+		}
+	}
+}
+
+/**
+ * Collects every model hit by a ray, keeping the nearest hit for objects reported more than once (compound shapes)
+ */
+struct SAllModelsRayCallback : public btCollisionWorld::RayResultCallback
+{
+	std::vector<std::pair<CBulletModel*, btScalar>> hits;
+
+	SAllModelsRayCallback()
+	{
+		m_collisionFilterGroup = btBroadphaseProxy::AllFilter;
+		m_collisionFilterMask = btBroadphaseProxy::AllFilter;
+	}
+
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace) override
+	{
+		// Objects without a model (the ground) are not ARGoS entities
+		CBulletModel* model = static_cast<CBulletModel*>(rayResult.m_collisionObject->getUserPointer());
+		if(!model)
+			return m_closestHitFraction;
+
+		m_collisionObject = rayResult.m_collisionObject;
+
+		for(auto& hit : hits)
+		{
+			if(hit.first == model)
+			{
+				hit.second = btMin(hit.second, rayResult.m_hitFraction);
+				return m_closestHitFraction;
+			}
+		}
+
+		hits.emplace_back(model, rayResult.m_hitFraction);
+		return m_closestHitFraction;
+	}
+};
+
+/**
+ * Finds the nearest model hit by a ray, ignoring anything which isn't an ARGoS entity
+ */
+struct SClosestModelRayCallback : public btCollisionWorld::RayResultCallback
+{
+	CBulletModel* closest{nullptr};
+
+	SClosestModelRayCallback()
+	{
+		m_collisionFilterGroup = btBroadphaseProxy::AllFilter;
+		m_collisionFilterMask = btBroadphaseProxy::AllFilter;
+	}
+
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace) override
+	{
+		CBulletModel* model = static_cast<CBulletModel*>(rayResult.m_collisionObject->getUserPointer());
+		if(!model)
+			return m_closestHitFraction;
+
+		// Returning the fraction lets bullet cull anything further away
+		closest = model;
+		m_collisionObject = rayResult.m_collisionObject;
+		m_closestHitFraction = rayResult.m_hitFraction;
+		return m_closestHitFraction;
+	}
+};
+
+/**
+ * Convert an ARGoS ray to its bullet end points
+ */
+static inline void rayToBullet(const CRay3& ray, float worldScale, btVector3& from, btVector3& to)
+{
+	const CVector3& start = ray.GetStart();
+	const CVector3& end = ray.GetEnd();
+	from = btVector3{(btScalar)start.GetX(), (btScalar)start.GetY(), (btScalar)start.GetZ()}*worldScale;
+	to = btVector3{(btScalar)end.GetX(), (btScalar)end.GetY(), (btScalar)end.GetZ()}*worldScale;
+}
+
+/**
+ * Cast the ray through bullet's broadphase and populate the provided intersection list with every entity hit
+ */
+void CBulletEngine::CheckIntersectionWithRay(argos::TEmbodiedEntityIntersectionData& ret, const CRay3 &c_ray) const
+{
+	btVector3 from, to;
+	rayToBullet(c_ray, worldScale, from, to);
+
+	// We always create a dbvt broadphase, whose own ray test isn't safe for the concurrent queries sensors make
+	SAllModelsRayCallback callback;
+	CBatchRayCaster caster{*static_cast<btDbvtBroadphase*>(overlappingPairCache), nullptr};
+	caster.CastRay(from, to, callback);
+
+	for(auto& hit : callback.hits)
+		ret.push_back(SEmbodiedEntityIntersectionItem{&hit.first->GetEmbodiedEntity(), hit.second});
+}
+
+/**
+ * Cast the ray through bullet's broadphase and return the first entity hit, if any
  */
 CEmbodiedEntity* CBulletEngine::CheckIntersectionWithRay(Real &f_t_on_ray, const CRay3 &c_ray) const
 {
-	CEmbodiedEntity* closest = nullptr;
-	Real fTOnRay;
+	btVector3 from, to;
+	rayToBullet(c_ray, worldScale, from, to);
+
+	// We always create a dbvt broadphase, whose own ray test isn't safe for the concurrent queries sensors make
+	SClosestModelRayCallback callback;
+	CBatchRayCaster caster{*static_cast<btDbvtBroadphase*>(overlappingPairCache), nullptr};
+	caster.CastRay(from, to, callback);
 
 	f_t_on_ray = pInf;
+	if(!callback.closest)
+		return nullptr;
 
-	for(auto& it : entityMap)
+	// Hit fractions are along the ray so are unaffected by the world scale
+	f_t_on_ray = callback.m_closestHitFraction;
+	return &callback.closest->GetEmbodiedEntity();
+}
+
+/**
+ * Cast a whole batch of rays at once, hits gets one entry per ray in the same order, misses included
+ */
+void CBulletEngine::CheckIntersectionWithRays(std::vector<SRayHit>& hits, const std::vector<CRay3>& rays) const
+{
+	int count = (int)rays.size();
+
+	btAlignedObjectArray<btVector3> from, to;
+	btAlignedObjectArray<CBatchRayCaster::SRayResult> results;
+	from.resize(count);
+	to.resize(count);
+	results.resize(count);
+
+	for(int i = 0; i < count; ++i)
+		rayToBullet(rays[i], worldScale, from[i], to[i]);
+
+	// We always create a dbvt broadphase
+	CBatchRayCaster caster{*static_cast<btDbvtBroadphase*>(overlappingPairCache), workerPool};
+	if(count)
+		caster.CastRays(&from[0], &to[0], count, &results[0]);
+
+	hits.resize(count);
+	for(int i = 0; i < count; ++i)
 	{
-		if(it.second->CheckIntersectionWithRay(fTOnRay, c_ray) && fTOnRay < f_t_on_ray)
+		if(results[i].object)
 		{
-			closest = &it.second->GetEmbodiedEntity();
-			f_t_on_ray = fTOnRay;
+			CBulletModel* model = static_cast<CBulletModel*>(results[i].object->getUserPointer());
+			hits[i] = SRayHit{&model->GetEmbodiedEntity(), results[i].fraction};
 		}
+		else
+			hits[i] = SRayHit{nullptr, pInf};
 	}
-
-	return closest;
 }
 
 /**
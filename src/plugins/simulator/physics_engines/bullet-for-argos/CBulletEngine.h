@@ -11,6 +11,8 @@ class CBulletModel;
 #include "BulletEntityRegistration.h"
 #include <argos3/core/simulator/physics_engine/physics_engine.h>
 
+#include <memory>
+
 using namespace argos;
 
 class btDefaultCollisionConfiguration;
@@ -18,10 +20,25 @@ class btCollisionDispatcher;
 class btBroadphaseInterface;
 class btSequentialImpulseConstraintSolver;
 class btDynamicsWorld;
+class btMultiBodyDynamicsWorld;
+class btMultiBody;
+class btMultiBodyConstraint;
+class btTypedConstraint;
 class btCollisionShape;
+class btCollisionObject;
+class btRigidBody;
+class WorkerPool;
+class CShapeCache;
+class CWorldSnapshot;
+class CStepProfiler;
 
 /*
- * An implementation of an ARGoS physics engine which uses the bullet engine underneath
+ * An implementation of an ARGoS physics engine which uses the bullet engine underneath.
+ *
+ * Any number of engines can run in one experiment, each owning the box of the arena given by its region_min and
+ * region_max and stepped on ARGoS's own threads. Entities leaving that box move to the engine owning where they went.
+ * Definitions, meshes and collision shapes are shared between them, so independent copies of an arena each cost a
+ * world of bodies rather than another set of assets.
  */
 class CBulletEngine : public CPhysicsEngine
 {
@@ -35,16 +52,73 @@ private:
 	btSequentialImpulseConstraintSolver* solver;					//
 
 	btDynamicsWorld* dynamicsWorld;							// Our world
+	btMultiBodyDynamicsWorld* multiBodyWorld;					// The same world if it supports btMultiBody, otherwise null
+	WorkerPool* workerPool;										// Threads used by the parallel world (if any)
 
 	double internalTimeStep;										// The time step used internally between ticks
 
-	std::vector<btCollisionShape*> collisionShapes;					// All possible colliding objects
+	std::vector<btCollisionShape*> collisionShapes;					// Shapes owned by the engine itself (ground)
+	std::shared_ptr<CShapeCache> shapeCache;						// Shapes shared between entities and engines
 	TMap entityMap;													// Name accessible ARGoS entities in this engine
 
 	std::vector<CBulletModel*> entities;							// All entities this engine handles
 
+	/**
+	 * Per-tick sync data for a model with a rigid body, kept contiguous so Update never touches the map
+	 */
+	struct SSyncRecord
+	{
+		CBulletModel* model;
+		btCollisionObject* object;
+		bool dynamic;			// Static bodies never need writing back to ARGoS
+		bool awake;				// Active after the previous step, so the step which put it to sleep is written back
+		bool dirty;				// ARGoS moved the entity, push it to bullet before the next step
+		bool restorable;		// Existed when the snapshot was taken so Reset can restore it directly
+		bool moved;				// Written back this tick, including the step which put it to sleep
+	};
+
+	std::vector<SSyncRecord> syncRecords;							// Models with rigid bodies
+	std::vector<int> dirtyRecords;									// Indices of records to push next tick
+	std::vector<CBulletModel*> perTickModels;						// Models without bodies (motors), synced every tick
+
 	int maxTicks{50};
 
+	bool deactivation{true};										// Can resting bodies be put to sleep?
+	double deactivationTime{2.0};									// Resting time before sleeping, the same for every engine
+	float linearSleepThreshold{0.8f};								// Speeds below which a body
+	float angularSleepThreshold{1.0f};								// counts as resting
+
+	bool cylinderHulls{false};										// Approximate link cylinders with hulls
+	int cylinderHullSegments{16};									// Points around each end of those hulls
+	int meshHullVertices{64};										// Most points in a reduced mesh hull, 0 for raw triangles
+
+	bool featherstone{false};										// Build multibodies as btMultiBody rather than hinged bodies
+	bool deterministic{false};										// Same results from a parallel world whatever its thread count
+
+	CWorldSnapshot* snapshot;										// The world before the first step, restored by Reset
+
+	std::string checkpointFile;										// Where checkpoints are written and resumed from
+	int checkpointInterval{0};										// Ticks between checkpoints, 0 to only write them when asked
+	bool resumePending{false};										// Carry on from the checkpoint on the first update
+
+	bool hasRegion{false};											// Only part of the arena belongs to this engine
+	CVector3 regionMin{nInf, nInf, nInf};							// Corners of the part which does (ARGoS units),
+	CVector3 regionMax{pInf, pInf, pInf};							// the maximum is excluded so regions can touch
+
+	std::vector<std::pair<CEntity*, CBulletModel*>> pendingTransfers;	// Entities which have left the region, and the
+																	// model whose position decides where they go
+
+	struct STransferredMotion;										// Motion carried to another bullet engine
+
+	CStepProfiler* profiler{nullptr};								// Times each phase of a tick, if enabled
+
+	void CreateWorld(bool parallel, unsigned int numThreads);		// Build the world selected in XML
+	void UpdateWorld();												// Push, step and write back one tick
+	void ResetSolverState();										// Forget warm starting and solver randomness
+	void FindTransfers();											// Queue entities which have left the region
+	void CaptureMotion(CEntity& entity, std::vector<STransferredMotion>& motion) const;
+	void ApplyMotion(const std::vector<STransferredMotion>& motion);
+
 public:								// The most subticks we will ever do in one update
 	float worldScale;
 	float worldScaleSquared;
@@ -55,6 +129,7 @@ public:								// The most subticks we will ever do in one update
 
 	virtual void Init(TConfigurationNode& t_tree) override;			// Load settings from ARGoS config
 	virtual void Update() override;									// Update the world state
+	virtual void Reset() override;									// Push every entity on the next update
 
 	virtual size_t GetNumPhysicsModels() override;					// How many objects are we handling?
 
@@ -65,20 +140,79 @@ public:								// The most subticks we will ever do in one update
 	virtual CEmbodiedEntity* CheckIntersectionWithRay(Real& f_t_on_ray, const CRay3 &c_ray) const;
 	virtual void CheckIntersectionWithRay(argos::TEmbodiedEntityIntersectionData& ret, const CRay3 &c_ray) const;
 
+	/**
+	 * First entity hit by one of a batch of rays, kept apart from ARGoS's intersection data as misses are included
+	 */
+	struct SRayHit
+	{
+		CEmbodiedEntity* entity;		// Null on a miss
+		Real t;							// Fraction along the ray, infinite on a miss
+	};
+
+	// First object hit by each of a batch of rays in the same order as the rays, for sensors with many rays
+	void CheckIntersectionWithRays(std::vector<SRayHit>& hits, const std::vector<CRay3>& rays) const;
+
 	// Add and remove created models (used by registration macros so may flag as unused by editors)
 	void AddPhysicsModel(const std::string& entityId, CBulletModel& model);
 	void RemovePhysicsModel(const std::string& entityId);
 	CBulletModel* GetPhysicsModel(std::string id);
 	std::vector<CBulletModel*>& GetPhysicsModels() { return entities; }
 
+	// Write everything needed to carry on from this tick, false if the file couldn't be written
+	bool SaveCheckpoint(const std::string& file);
+
+	// Carry on from a checkpoint written by the same experiment, false if there isn't one
+	bool LoadCheckpoint(const std::string& file);
+
+	// Take things models added themselves out of the world for good, deleting them
+	void DestroyConstraint(btTypedConstraint* constraint);
+	void DestroyMultiBodyConstraint(btMultiBodyConstraint* constraint);
+	void DestroyMultiBody(btMultiBody* multiBody);
+
+	// Flag a model whose ARGoS entity was moved so bullet is updated before the next step
+	void MarkDirty(CBulletModel& model);
+
+	// Push a model to bullet now if ARGoS has moved it, for queries which can't wait for the next tick
+	void PushIfDirty(const CBulletModel& model);
+
+	// A model put its body where ARGoS is moving it itself, so there is nothing left to push
+	void MarkPlaced(CBulletModel& model);
+
+	// Apply the configured sleeping behaviour to a new body
+	void ConfigureActivation(btRigidBody& body) const;
+
+	// The same for a btMultiBody and its link colliders, once they are attached
+	void ConfigureActivation(btMultiBody& multiBody) const;
+
+	// How multibody link cylinders should be represented
+	bool UseCylinderHulls() const { return cylinderHulls; }
+	int GetCylinderHullSegments() const { return cylinderHullSegments; }
+
+	// How multibody link meshes should be represented
+	int GetMeshHullVertices() const { return meshHullVertices; }
+
+	// Should multibody entities be single reduced coordinate btMultiBody objects?
+	bool UseFeatherstone() const { return featherstone; }
+
+	// Can resting bodies be put to sleep?
+	bool AllowsDeactivation() const { return deactivation; }
+
+	// Length of each internal step
+	double GetInternalTimeStep() const { return internalTimeStep; }
+
 	static short GetObjectGroup(bool isStatic);
 	static short GetObjectCollisionFlags(bool isStatic);
 
 	btDynamicsWorld* GetBulletWorld(){ return dynamicsWorld; }
+	btMultiBodyDynamicsWorld* GetMultiBodyWorld(){ return multiBodyWorld; }
+	CShapeCache& GetShapeCache(){ return *shapeCache; }
+
+	// Does this engine own the given point of the arena?
+	virtual bool IsPointContained(const CVector3& vec);
 
-//	virtual bool IsPointContained(const CVector3& vec){return true;}
-//	virtual bool IsEntityTransferNeeded() const {return false;}
-//	virtual void TransferEntities(){};
+	// Move entities which have left the region to the engines owning where they are now
+	virtual bool IsEntityTransferNeeded() const { return !pendingTransfers.empty(); }
+	virtual void TransferEntities();
 };
 
 #endif //ARGOS3_BULLET_CBULLETENGINE_H
@@ -41,7 +41,7 @@ CBulletModel::~CBulletModel()
  * Base class for all bullet physics models
  */
 CBulletModel::CBulletModel(CBulletEngine& engine, CEmbodiedEntity& entity)
-		: CPhysicsModel(engine, entity), engine(&engine), rigidBody(nullptr)
+		: CPhysicsModel(engine, entity), engine(&engine), rigidBody(nullptr), syncIndex(-1)
 {
 	// If the associated embodied entity has no origin anchor then there is nothing more we can do
 	if(!&GetEmbodiedEntity().GetOriginAnchor())
@@ -67,67 +67,60 @@ void CBulletModel::UpdateOriginAnchor(SAnchor &anchor)
 }
 
 /**
- * Generic method to check for collisions between all objects
+ * Reports whether a contact test found any real penetration with another entity
  */
-bool CBulletModel::IsCollidingWithSomething() const
+struct SPenetrationCallback : public btCollisionWorld::ContactResultCallback
 {
-	// Get all entities our engine is responsible for
-	std::vector<CBulletModel*> allEntities = engine->GetPhysicsModels();
-
-	// Get our location and position
-	CQuaternion q = GetEmbodiedEntity().GetOriginAnchor().Orientation;
-	CVector3 loc = GetEmbodiedEntity().GetOriginAnchor().Position;
-	SBoundingBox bb = GetBoundingBox();
+	const btCollisionObject* self;
+	bool colliding{false};
 
-	// Extract all 8 corners of the bounding box as separate points in the global coordinate frame
-	CVector3 corners[8];
-	for(char i = 0; i < 8; ++i)
+	SPenetrationCallback(const btCollisionObject* self) : self(self)
 	{
-		// Get the appropriate corner values
-		corners[i].SetX((i&0x1 ? bb.MinCorner : bb.MaxCorner).GetX());
-		corners[i].SetY((i&0x2 ? bb.MinCorner : bb.MaxCorner).GetY());
-		corners[i].SetZ((i&0x4 ? bb.MinCorner : bb.MaxCorner).GetZ());
-
-		// Rotate to the global frame
-		corners[i].Rotate(q.Inverse());
-
-		// Offset by the body's position
-		corners[i] += loc;
+		// Any overlap counts, even between objects which never collide in the simulation
+		m_collisionFilterGroup = btBroadphaseProxy::AllFilter;
+		m_collisionFilterMask = btBroadphaseProxy::AllFilter;
 	}
 
-	// Extract all 12 edges as rays from one corner to another
-	CRay3 rays[12];
-
-	// These 4 corners are used as the start points
-	uint8_t startCorners[]{0x0, 0x3, 0x5, 0x6};
-
-	// Set each ray to extend from the current start corner to 1 of the 3 connected edges
-	for(int i = 0; i < 12; i+=3)
+	virtual bool needsCollision(btBroadphaseProxy* proxy) const override
 	{
-		rays[ i ].Set(corners[startCorners[i]], corners[startCorners[i] ^ 0x1]);	// Corner indices have been chosen
-		rays[i+1].Set(corners[startCorners[i]], corners[startCorners[i] ^ 0x2]);	// to make this work as efficiently
-		rays[i+2].Set(corners[startCorners[i]], corners[startCorners[i] ^ 0x4]);	// as possible.
+		// Ignore the ground and anything we are deliberately not colliding with (linked bodies)
+		const btCollisionObject* other = static_cast<const btCollisionObject*>(proxy->m_clientObject);
+		return !colliding && other->getUserPointer() && self->checkCollideWith(other);
 	}
 
-	// Check for collisions with all entities
-	for(auto e : allEntities)
+	virtual btScalar addSingleResult(btManifoldPoint& cp, const btCollisionObjectWrapper* colObj0Wrap, int partId0,
+									 int index0, const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1) override
 	{
-		// Skip checking for collision with this object
-		if(e != this)
-		{
-			// Never actually read but required by CheckIntersectionWithRay
-			Real r {0};
-
-			// Check every edge for intersection
-			for(CRay3& ray : rays)
-			{
-				if(e->CheckIntersectionWithRay(r, ray))
-					return true;
-			}
-		}
+		if(cp.getDistance() < 0)
+			colliding = true;
+
+		return 0;
 	}
+};
 
-	return false;
+/**
+ * Check for collisions by running our body through bullet's broadphase and narrowphase
+ */
+bool CBulletModel::IsCollidingWithSomething() const
+{
+	btCollisionObject* object = GetCollisionObject();
+	if(!object)
+		return false;
+
+	// ARGoS may have moved us since the last tick
+	engine->PushIfDirty(*this);
+
+	SPenetrationCallback callback{object};
+	engine->GetBulletWorld()->contactTest(object, callback);
+	return callback.colliding;
+}
+
+/**
+ * Most models collide through their own rigid body
+ */
+btCollisionObject* CBulletModel::GetCollisionObject() const
+{
+	return GetRigidBody();
 }
 
 /**
@@ -140,21 +133,28 @@ void CBulletModel::Reset()
 	velocity = CVector3{0,0,0};
 	acceleration = CVector3{0,0,0};
 
-	// Clear the bullet values too
-	GetRigidBody()->setAngularVelocity(btVector3{0,0,0});
-	GetRigidBody()->setLinearVelocity(btVector3{0,0,0});
+	// Clear the bullet values too, anything without its own rigid body is reset by whatever owns it
+	if(GetRigidBody())
+	{
+		GetRigidBody()->setAngularVelocity(btVector3{0,0,0});
+		GetRigidBody()->setLinearVelocity(btVector3{0,0,0});
+	}
 
 	// Recalculate where we are
 	CalculateBoundingBox();
+
+	// And make sure bullet hears about it
+	engine->MarkDirty(*this);
 }
 
 /**
- * Change the location of the object
+ * Change the location of the object. ARGoS tests for collisions before it updates the anchor, so the body is moved
+ * straight away and the anchor isn't pushed over it on the next tick.
  */
 void CBulletModel::MoveTo(const CVector3& position, const CQuaternion& orientation)
 {
-	this->position = position;
-	UpdateEntityStatus();
+	PlaceAt(position, orientation);
+	engine->MarkPlaced(*this);
 }
 
 /**
@@ -9,6 +9,7 @@
 
 class CBulletEngine;
 class btRigidBody;
+class btCollisionObject;
 class btTransform;
 class btMotionState;
 
@@ -38,6 +39,10 @@ protected:
 	CBulletEngine* engine;
 	btRigidBody* rigidBody;
 
+	// Position of this model in the engine's sync records
+	friend class CBulletEngine;
+	int syncIndex;
+
 public:
 	CBulletModel(CBulletEngine& engine, CEmbodiedEntity& entity);
 	virtual ~CBulletModel();
@@ -48,6 +53,9 @@ public:
 	virtual void Step() = 0;
 	virtual void UpdateFromEntityStatus() = 0;
 
+	// Put the body where the entity's origin anchor would be at the given pose, offsets and world scale applied
+	virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) {}
+
 	virtual bool IsCollidingWithSomething() const;
 
 	virtual bool CheckIntersectionWithRay(Real& f_t_on_ray, const CRay3& ray) { return false; }
@@ -55,7 +63,24 @@ public:
 	void UpdateOriginAnchor(SAnchor& anchor);
 
 	virtual btRigidBody* GetRigidBody() const = 0;
+
+	// What bullet collides, the rigid body unless the model is part of something else such as a btMultiBody
+	virtual btCollisionObject* GetCollisionObject() const;
+
+	// Models which only delegate to separately registered models can opt out of the engine's sync
+	virtual bool RequiresSync() const { return true; }
+
+	// State a checkpoint has to carry beyond the bodies bullet stores itself, read back in the same order
+	virtual void WriteCheckpoint(std::vector<float>& values) const {}
+	virtual void ReadCheckpoint(const std::vector<float>& values) {}
+
 	virtual void AddToEngine(CBulletEngine& engine);
+
+	// Take out anything the model added to the world beyond its own collision object, which the engine removes
+	virtual void RemoveFromEngine(CBulletEngine& engine) {}
+
+	// Entity which moves to another engine when this model leaves the region, null if the model doesn't decide that
+	virtual CEntity* GetTransferEntity() { return &GetEmbodiedEntity().GetRootEntity(); }
 };
 
 /**
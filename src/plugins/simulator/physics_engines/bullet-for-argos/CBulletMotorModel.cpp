@@ -3,8 +3,12 @@
 //
 
 #include "./bullet/src/btBulletDynamicsCommon.h"
+#include <BulletDynamics/Featherstone/btMultiBody.h>
+#include <BulletDynamics/Featherstone/btMultiBodyDynamicsWorld.h>
+#include <BulletDynamics/Featherstone/btMultiBodyJointMotor.h>
 #include <argos3/core/simulator/simulator.h>
 #include "CBulletMotorModel.h"
+#include "CBulletMultibodyLink.h"
 #include "CBulletEngine.h"
 
 #include "transform_utils.h"
@@ -26,6 +30,29 @@ void CBulletMotorModel::UpdateFromEntityStatus()
 	// @TODO: Improve
 	// There must be a better way to do this?
 	float targetPosition = entity->getVelocityTarget();		// Rads/sec
+
+	// Featherstone joints are driven at the target velocity directly
+	if(multiBody)
+	{
+		if(!multiBodyMotor)
+			return;
+
+		if(targetPosition != lastVelocityTarget || targetPosition != 0)
+			multiBody->wakeUp();
+		lastVelocityTarget = targetPosition;
+
+		multiBodyMotor->setVelocityTarget(targetPosition);
+		return;
+	}
+
+	// A sleeping island ignores its constraints, so wake both bodies whenever the motor is asked to do something
+	if(targetPosition != lastVelocityTarget || targetPosition != 0)
+	{
+		motor->getRigidBodyA().activate();
+		motor->getRigidBodyB().activate();
+	}
+	lastVelocityTarget = targetPosition;
+
 	targetPosition *= engine->GetSimulationClockTick();		// Rads/sec * sec/tick = Rads/tick
 	targetPosition += motor->getHingeAngle();
 	motor->setMotorTarget(targetPosition, engine->GetSimulationClockTick());
@@ -36,9 +63,37 @@ void CBulletMotorModel::UpdateFromEntityStatus()
  */
 void CBulletMotorModel::UpdateEntityStatus()
 {
+	if(multiBody)
+	{
+		if(multiBodyMotor)
+			entity->SetPositionCurrent(multiBody->getJointPos(multiBodyIndex));
+		return;
+	}
+
     entity->SetPositionCurrent(motor->getHingeAngle());
 }
 
+/**
+ * The target the controller last asked for and the one last given to bullet
+ */
+void CBulletMotorModel::WriteCheckpoint(std::vector<float>& values) const
+{
+	values.push_back(entity->GetVelocityTarget());
+	values.push_back(lastVelocityTarget);
+}
+
+/**
+ * Carry on driving the joint at the checkpoint's targets
+ */
+void CBulletMotorModel::ReadCheckpoint(const std::vector<float>& values)
+{
+	entity->RestoreVelocityTarget(values[0]);
+	lastVelocityTarget = values[1];
+
+	if(multiBodyMotor)
+		multiBodyMotor->setVelocityTarget(lastVelocityTarget);
+}
+
 /**
  * This doesn't make sense for a motor, do nothing
  */
@@ -56,6 +111,23 @@ void CBulletMotorModel::AddToEngine(CBulletEngine &engine)
     CComposableEntity* parentEntity = entity->getParentEntity();
     CComposableEntity* childEntity = entity->getChildEntity();
 
+	// The joint already exists inside the btMultiBody, the motor only has to drive the child link's joint
+	if(engine.UseFeatherstone())
+	{
+		CBulletMultibodyLink* childLink = static_cast<CBulletMultibodyLink*>(engine.GetPhysicsModel(childEntity->GetId()));
+		multiBody = childLink->GetMultiBody();
+		multiBodyIndex = childLink->GetMultiBodyIndex();
+
+		// Fixed joints have nothing to drive
+		if(multiBody->getLink(multiBodyIndex).m_jointType == btMultibodyLink::eFixed)
+			return;
+
+		multiBodyMotor = new btMultiBodyJointMotor{multiBody, multiBodyIndex, 0,
+												   (btScalar)(entity->GetEffortMax() * engine.GetInternalTimeStep())};
+		engine.GetMultiBodyWorld()->addMultiBodyConstraint(multiBodyMotor);
+		return;
+	}
+
 	// And their corresponding physics entities
     btRigidBody* parentBody = engine.GetPhysicsModel(parentEntity->GetId())->GetRigidBody();
     btRigidBody* childBody = engine.GetPhysicsModel(childEntity->GetId())->GetRigidBody();
@@ -97,4 +169,18 @@ void CBulletMotorModel::AddToEngine(CBulletEngine &engine)
     engine.GetBulletWorld()->addConstraint(motor, disableCollisionCheckingBetweenParentAndChild);
 }
 
+/**
+ * Take the joint back out of the world, before the bodies it joins are removed
+ */
+void CBulletMotorModel::RemoveFromEngine(CBulletEngine &engine)
+{
+	if(motor)
+		engine.DestroyConstraint(motor);
+	if(multiBodyMotor)
+		engine.DestroyMultiBodyConstraint(multiBodyMotor);
+
+	motor = nullptr;
+	multiBodyMotor = nullptr;
+}
+
 REGISTER_BULLET_ENTITY_OPS(CMotorActuatorEntity, CBulletMotorModel)
@@ -10,6 +10,9 @@
 #include "CBulletEngine.h"
 #include "MultibodyDefinitions.h"
 
+class btMultiBody;
+class btMultiBodyJointMotor;
+
 /**
  * Basic, continuous motor model for the bullet physics engine
  */
@@ -25,16 +28,28 @@ public:
 	virtual btRigidBody* GetRigidBody() const { return nullptr; }
 
 	virtual void AddToEngine(CBulletEngine& engine);
+	virtual void RemoveFromEngine(CBulletEngine& engine) override;
+
+	// Motors follow the entity their links belong to
+	virtual CEntity* GetTransferEntity() override { return nullptr; }
+
+	virtual void WriteCheckpoint(std::vector<float>& values) const override;
+	virtual void ReadCheckpoint(const std::vector<float>& values) override;
 
 	CMotorActuatorEntity* GetEntity() { return  entity; }
 
 private:
-    btHingeConstraint* motor;
+    btHingeConstraint* motor{nullptr};
+    btMultiBodyJointMotor* multiBodyMotor{nullptr};		// Used instead of the hinge for Featherstone multibodies
+    btMultiBody* multiBody{nullptr};
+    int multiBodyIndex{-1};							// The link this motor drives
     CBulletEngine* engine;
 	CMotorActuatorEntity* entity;
 
 	JointType type;
 
+	float lastVelocityTarget{0};		// Target applied on the previous tick, changes wake the bodies
+
 	void CalculateBoundingBox();
 };
 
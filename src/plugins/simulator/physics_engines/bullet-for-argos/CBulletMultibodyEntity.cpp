@@ -3,7 +3,30 @@
 //
 
 #include "./bullet/src/btBulletDynamicsCommon.h"
+#include <BulletDynamics/Featherstone/btMultiBody.h>
+#include <BulletDynamics/Featherstone/btMultiBodyDynamicsWorld.h>
+#include <BulletDynamics/Featherstone/btMultiBodyJointLimitConstraint.h>
 #include "CBulletMultibodyEntity.h"
+#include "transform_utils.h"
+
+#include <set>
+
+/**
+ * Links which are not the child of any joint, a single tree of links has exactly one
+ */
+static std::vector<std::string> rootLinks(CMultibodyEntity &entity)
+{
+	std::set<std::string> children;
+	for(auto& pair : entity.getCurrentState().getJointMap())
+		children.insert(pair.second.child);
+
+	std::vector<std::string> roots;
+	for(auto& pair : entity.getLinkEntityMap())
+		if(!children.count(pair.first))
+			roots.push_back(pair.first);
+
+	return roots;
+}
 
 /**
  * A bullet physics model for a multi-bodied entity.
@@ -21,15 +44,189 @@ CBulletMultibodyEntity::CBulletMultibodyEntity(CBulletEngine &engine, CMultibody
 	for (auto pair : entity.getLinkEntityMap())
 	{
 		auto bulletLink = new CBulletMultibodyLink {engine, *pair.second};
+		bulletLink->SetOwner(this);
 		bulletLinks[pair.first] = bulletLink;
 	}
 
+	// The base decides which engine the whole entity belongs to
+	std::vector<std::string> roots = rootLinks(entity);
+	if(roots.size() == 1)
+		baseLink = bulletLinks[roots[0]];
+
 	// And all joints
 	for (auto pair : entity.getJointEntityMap())
 	{
 		auto bulletJoint = new CBulletMotorModel{engine, *pair.second};
 		bulletJoints[pair.first] = bulletJoint;
 	}
+
+	if(engine.UseFeatherstone())
+		BuildMultiBody(engine, entity);
+}
+
+/**
+ * Join every link into one btMultiBody, with the link no joint moves as its base and a link for each joint
+ */
+void CBulletMultibodyEntity::BuildMultiBody(CBulletEngine &engine, CMultibodyEntity &entity)
+{
+	const auto& joints = entity.getCurrentState().getJointMap();
+
+	// The base is the one link which is not the child of any joint
+	std::vector<std::string> order = rootLinks(entity);
+	if(order.size() != 1)
+		THROW_ARGOSEXCEPTION("Featherstone multibody \"" << entity.GetId() << "\" needs exactly one root link, it has " << order.size());
+
+	// btMultiBody needs parents before their children, a breadth first walk down the joints gives that
+	std::vector<const JointDefinition*> linkJoints;
+	for(size_t i = 0; i < order.size() && order.size() <= bulletLinks.size(); ++i)
+	{
+		for(auto& pair : joints)
+		{
+			if(pair.second.parent != order[i])
+				continue;
+
+			order.push_back(pair.second.child);
+			linkJoints.push_back(&pair.second);
+			linkMotors.push_back(entity.getJointEntityMap()[pair.first]);
+		}
+	}
+
+	if(order.size() != bulletLinks.size())
+		THROW_ARGOSEXCEPTION("Featherstone multibody \"" << entity.GetId() << "\" must be a single tree of links");
+
+	std::map<std::string, int> linkIndices;
+	linkIndices[order[0]] = -1;
+
+	// A massless root is a static body in rigid mode, here it has to be a fixed base or the base inertia is singular
+	bool fixedBase = baseLink->GetMass() == 0;
+	multiBody = new btMultiBody{(int)order.size() - 1, baseLink->GetMass(), baseLink->GetLocalInertia(), fixedBase,
+								engine.AllowsDeactivation(), true};
+
+	// Each link sits at its joint and turns about the joint's axis in its own frame, the same as in ARGoS
+	for(size_t i = 1; i < order.size(); ++i)
+	{
+		const JointDefinition& def = *linkJoints[i - 1];
+		CBulletMultibodyLink* link = bulletLinks[order[i]];
+		CMotorActuatorEntity* motor = linkMotors[i - 1];
+
+		int index = (int)i - 1;
+		int parent = linkIndices[def.parent];
+		linkIndices[order[i]] = index;
+
+		btTransform mount = bulletTransformFromARGoS(motor->GetPosition(), motor->GetOrientation());
+		btQuaternion parentToThis = mount.getRotation().inverse();
+		CVector3 axis = motor->GetAxis();
+		btVector3 btAxis = btVector3{(btScalar)axis.GetX(), (btScalar)axis.GetY(), (btScalar)axis.GetZ()}.normalized();
+		btVector3 comOffset{0, 0, 0};
+
+		switch(def.type)
+		{
+			case Fixed:
+				multiBody->setupFixed(index, link->GetMass(), link->GetLocalInertia(), parent, parentToThis,
+									  mount.getOrigin(), comOffset, true);
+				break;
+			case Prismatic:
+				multiBody->setupPrismatic(index, link->GetMass(), link->GetLocalInertia(), parent, parentToThis, btAxis,
+										  mount.getOrigin(), comOffset, true);
+				break;
+			default:
+				multiBody->setupRevolute(index, link->GetMass(), link->GetLocalInertia(), parent, parentToThis, btAxis,
+										 mount.getOrigin(), comOffset, true);
+				break;
+		}
+
+		// Continuous joints spin freely, limited ones are held in range by the solver
+		if((def.type == Revolute || def.type == Prismatic) && def.limitLower < def.limitUpper)
+			jointLimits.push_back(new btMultiBodyJointLimitConstraint{multiBody, index, def.limitLower, def.limitUpper});
+	}
+
+	multiBody->finalizeMultiDof();
+
+	for(size_t i = 0; i < order.size(); ++i)
+		bulletLinks[order[i]]->AttachToMultiBody(multiBody, (int)i - 1, this);
+	engine.ConfigureActivation(*multiBody);
+
+	PushFromEntities();
+}
+
+/**
+ * Adds each of the entities parts to the engine, after the btMultiBody they belong to
+ */
+void CBulletMultibodyEntity::AddToEngine(CBulletEngine &engine)
+{
+	if(multiBody)
+	{
+		engine.GetMultiBodyWorld()->addMultiBody(multiBody);
+		for(auto limit : jointLimits)
+			engine.GetMultiBodyWorld()->addMultiBodyConstraint(limit);
+	}
+
+	for (auto pair : bulletLinks) engine.AddPhysicsModel(pair.second->GetEmbodiedEntity().GetId(), *pair.second);
+	for (auto pair : bulletJoints) engine.AddPhysicsModel(pair.second->GetEntity()->GetId(), *pair.second);
+}
+
+/**
+ * Removes each of the entities parts from the engine, then the btMultiBody they belonged to
+ */
+void CBulletMultibodyEntity::RemoveFromEngine(CBulletEngine &engine)
+{
+	for (auto pair : bulletJoints) engine.RemovePhysicsModel(pair.second->GetEntity()->GetId());
+	for (auto pair : bulletLinks) engine.RemovePhysicsModel(pair.second->GetEmbodiedEntity().GetId());
+	bulletJoints.clear();
+	bulletLinks.clear();
+	baseLink = nullptr;
+
+	if(multiBody)
+	{
+		for(auto limit : jointLimits)
+			engine.DestroyMultiBodyConstraint(limit);
+		engine.DestroyMultiBody(multiBody);
+	}
+
+	jointLimits.clear();
+	multiBody = nullptr;
+}
+
+/**
+ * Move the btMultiBody to the root link's anchor with the joints at the motors' positions, at rest
+ */
+void CBulletMultibodyEntity::PushFromEntities()
+{
+	if(!multiBody)
+		return;
+
+	const SAnchor& anchor = baseLink->GetEntity()->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceBase(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Set the base and joint positions then bring the colliders along
+ */
+void CBulletMultibodyEntity::PlaceBase(const CVector3& position, const CQuaternion& orientation)
+{
+	if(!multiBody)
+		return;
+
+	multiBody->setBaseWorldTransform(bulletTransformFromARGoS(position, orientation));
+	multiBody->setBaseVel(btVector3{0, 0, 0});
+	multiBody->setBaseOmega(btVector3{0, 0, 0});
+
+	for(int i = 0; i < multiBody->getNumLinks(); ++i)
+	{
+		// Fixed joints have no position to set
+		if(multiBody->getLink(i).m_jointType == btMultibodyLink::eFixed)
+			continue;
+
+		multiBody->setJointPos(i, linkMotors[i]->GetPositionCurrent());
+		multiBody->setJointVel(i, 0);
+	}
+
+	// Move the colliders to match
+	btAlignedObjectArray<btQuaternion> scratchRotations;
+	btAlignedObjectArray<btVector3> scratchVectors;
+	multiBody->forwardKinematics(scratchRotations, scratchVectors);
+	multiBody->updateCollisionObjectWorldTransforms(scratchRotations, scratchVectors);
+	multiBody->wakeUp();
 }
 
 REGISTER_BULLET_ENTITY_OPS(CMultibodyEntity, CBulletMultibodyEntity)
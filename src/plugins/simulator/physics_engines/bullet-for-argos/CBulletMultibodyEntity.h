@@ -10,10 +10,13 @@
 #include "CBulletMultibodyLink.h"
 #include "CBulletMotorModel.h"
 
+class btMultiBody;
+class btMultiBodyConstraint;
+
 /**
  * A multibodied entity model. This entity does not contain its own rigid body,
  * instead acting simply as a container for other rigid body models and delegating
- * calls to them as appropriate
+ * calls to them as appropriate. With Featherstone enabled the links share a single btMultiBody instead.
  */
 class CBulletMultibodyEntity : public CBulletModel
 {
@@ -51,23 +54,57 @@ public:
 		return false;
 	};
 
+	virtual bool IsCollidingWithSomething() const override
+	{
+		for(auto pair : bulletLinks)
+			if(pair.second->IsCollidingWithSomething())
+				return true;
+
+		return false;
+	}
+
 	virtual btRigidBody *GetRigidBody() const
 	{
 		return rigidBody;
 	}
 
 	/**
-	 * Adds each of the entities parts to the engine
+	 * Links and joints are registered with the engine themselves, no need to sync them twice
 	 */
-	void AddToEngine(CBulletEngine &engine)
+	virtual bool RequiresSync() const
 	{
-		for (auto pair : bulletLinks) engine.AddPhysicsModel(pair.second->GetEmbodiedEntity().GetId(), *pair.second);
-		for (auto pair : bulletJoints) engine.AddPhysicsModel(pair.second->GetEntity()->GetId(), *pair.second);
+		return false;
 	}
 
+	/**
+	 * Adds each of the entities parts to the engine
+	 */
+	void AddToEngine(CBulletEngine &engine);
+
+	/**
+	 * Removes each of the entities parts, the joints before the links they join
+	 */
+	virtual void RemoveFromEngine(CBulletEngine &engine) override;
+
+	// Place the btMultiBody (if any) where ARGoS has its root link and joints
+	void PushFromEntities();
+
+	// The same with the root link at the given pose rather than its anchor
+	void PlaceBase(const CVector3& position, const CQuaternion& orientation);
+
+	// The link no joint moves, null if the links don't form a single tree
+	CBulletMultibodyLink* GetBaseLink() const { return baseLink; }
+
 private:
 	std::map<std::string, CBulletMultibodyLink*> bulletLinks;
 	std::map<std::string, CBulletMotorModel *> bulletJoints;
+
+	btMultiBody* multiBody{nullptr};						// Every link in reduced coordinates, if enabled
+	CBulletMultibodyLink* baseLink{nullptr};				// Link that is the base of the tree (and the btMultiBody)
+	std::vector<CMotorActuatorEntity*> linkMotors;			// Joint moving each btMultiBody link
+	std::vector<btMultiBodyConstraint*> jointLimits;		// Added to the world alongside the btMultiBody
+
+	void BuildMultiBody(CBulletEngine &engine, CMultibodyEntity &entity);
 };
 
 
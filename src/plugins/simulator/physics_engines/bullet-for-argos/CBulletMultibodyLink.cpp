@@ -6,10 +6,17 @@
 #include <BulletCollision/Gimpact/btGImpactShape.h>
 #include "CBulletMultibodyLink.h"
 #include <BulletCollision/Gimpact/btCompoundFromGimpact.h>
+#include <BulletDynamics/Featherstone/btMultiBody.h>
+#include <BulletDynamics/Featherstone/btMultiBodyLinkCollider.h>
 #include "./bullet/src/btBulletDynamicsCommon.h"
 #include "CBulletModel.h"
+#include "CBulletMultibodyEntity.h"
 
 #include "transform_utils.h"
+#include "CShapeCache.h"
+
+#include <iomanip>
+#include <sstream>
 
 #define COLLISION_MARGIN (0.0001f)
 
@@ -22,7 +29,7 @@ bool propertiesSet(const MaterialInstance& instance)
  * Constructor for a multibodied entity part.
  *
  * Extracts the required information from the provided ARGoS entity and adds an appropriate
- * rigid body shape to the simulation
+ * rigid body shape to the simulation. Links of Featherstone multibodies get their collider later instead.
  */
 CBulletMultibodyLink::CBulletMultibodyLink(CBulletEngine &engine, CMultibodyLinkEntity &entity) : CBulletModel(engine, entity.GetEmbodiedEntity())
 {
@@ -32,38 +39,23 @@ CBulletMultibodyLink::CBulletMultibodyLink(CBulletEngine &engine, CMultibodyLink
 
     const Link& link = entity.getCurrentState();
 
-	// Create a new compound collision shape.
-	// This may only hold 1 actual shape but it is easier to create a
-	// compound shape and add to it as necessary
-    btCompoundShape* collisionShape = new btCompoundShape{};
-
-	// Cycle over each definition in the link's collision definition
-    for(auto part : link.collision)
-    {
-		// Add the appropriate collision shape depending on it's type
-        switch(part.type)
-        {
-            case Box:
-                addBoxToCollisionShape(collisionShape, part);
-                break;
-            case Cylinder:
-                addCylinderToCollisionShape(collisionShape, part);
-                break;
-            case Sphere:
-                addSphereToCollisionShape(collisionShape, part);
-                break;
-            case Mesh:
-                addMeshToCollisionShape(collisionShape, part);
-                break;
-        }
-    }
+	// Fetch each part of the link's collision definition from the cache, identical links on other robots share them
+    collisionShape = getCollisionShape(engine, link);
 
 	// Initialise the inertia tensor to the provided value or let bullet calculate it
-    btVector3 inertia;
+    mass = link.mass;
     if(link.inertiaProvided)
-        inertia.setValue(link.ixx, link.iyy, link.izz);
+        localInertia.setValue(link.ixx, link.iyy, link.izz);
     else
-        collisionShape->calculateLocalInertia(link.mass, inertia);
+        collisionShape->calculateLocalInertia(link.mass, localInertia);
+
+	// Check we have some physical properties and fail if not
+    if(!propertiesSet(link.collisionMaterial))
+        THROW_ARGOSEXCEPTION("Attempting to use a material without necessary properties in link "<<link.name<<". Collision materials are currently only supported up to the level of links, not individual collision shapes.");
+
+	// The owning entity attaches us to its btMultiBody once every link exists
+    if(engine.UseFeatherstone())
+        return;
 
 	// Get the required orientation and position from the ARGoS entity
 	CQuaternion argosOrientation = entity.GetEmbodiedEntity().GetOriginAnchor().Orientation;
@@ -74,16 +66,12 @@ CBulletMultibodyLink::CBulletMultibodyLink(CBulletEngine &engine, CMultibodyLink
 
 	// Create a rigid body with the calculated shape
     btMotionState* motionState = new btDefaultMotionState{transform};
-    btRigidBody* body = new btRigidBody{link.mass, motionState, collisionShape, inertia};
-
-	// Check we have some physical properties and fail if not
-    if(!propertiesSet(link.collisionMaterial))
-        THROW_ARGOSEXCEPTION("Attempting to use a material without necessary properties in link "<<link.name<<". Collision materials are currently only supported up to the level of links, not individual collision shapes.");
+    btRigidBody* body = new btRigidBody{link.mass, motionState, collisionShape, localInertia};
 
 	// Setup our body
     body->setFriction(link.collisionMaterial.properties.friction);
     body->setRestitution(1-link.collisionMaterial.properties.dampening);
-    body->setActivationState(DISABLE_DEACTIVATION);
+    engine.ConfigureActivation(*body);
 
 	// Retain a reference to it
     rigidBody = body;
@@ -94,126 +82,226 @@ CBulletMultibodyLink::CBulletMultibodyLink(CBulletEngine &engine, CMultibodyLink
 }
 
 /**
- * Add a new shape to the provided compound shape in the position specified
+ * Transform of a part relative to its link
  */
-inline void addShapeToCompound(btCompoundShape* compund, btCollisionShape* toAdd, GeometrySpecification &spec)
+inline btTransform partTransform(const GeometrySpecification &spec)
 {
-	// Create the transform
     btVector3 offset{spec.originX, spec.originY, spec.originZ};
     btQuaternion rotation{spec.yaw, spec.pitch, spec.roll};
-    btTransform transform {rotation, offset};
-
-	// And do the add
-    compund->addChildShape(transform, toAdd);
+    return btTransform {rotation, offset};
 }
 
 /**
- * Add a box to the collision shape
+ * Build the compound shape for a link from its parts, or reuse an identical one
  */
-void CBulletMultibodyLink::addBoxToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec) {
-	// Create the box shape
-    btCollisionShape* shape = new btBoxShape{0.5f * btVector3{spec.box.x, spec.box.y, spec.box.z}};
+btCompoundShape* CBulletMultibodyLink::getCollisionShape(CBulletEngine& engine, const Link& link)
+{
+    CShapeCache& cache = engine.GetShapeCache();
+
+	// Get each part, building the key of the whole link as we go
+    std::vector<btCollisionShape*> parts;
+    std::vector<btTransform> transforms;
+    std::string key = "link";
+    for(auto part : link.collision)
+    {
+        btCollisionShape* shape = nullptr;
+        btTransform transform = partTransform(part);
+        switch(part.type)
+        {
+            case Box:
+                shape = getBoxCollisionShape(cache, part);
+                break;
+            case Cylinder:
+                shape = getCylinderCollisionShape(engine, part, transform);
+                break;
+            case Sphere:
+                shape = getSphereCollisionShape(cache, part);
+                break;
+            case Mesh:
+                shape = getMeshCollisionShape(engine, part);
+                break;
+        }
+
+        parts.push_back(shape);
+        transforms.push_back(transform);
+        key += " [" + cache.GetKey(shape) + " " + CShapeCache::TransformKey(transform) + "]";
+    }
+
+	// Someone else already has this exact link, we don't need our own references to its parts
+    if(btCollisionShape* existing = cache.Find(key))
+    {
+        for(auto shape : parts)
+            cache.Release(shape);
+        return static_cast<btCompoundShape*>(existing);
+    }
+
+	// Create a new compound collision shape.
+	// This may only hold 1 actual shape but it is easier to create a
+	// compound shape and add to it as necessary
+    btCompoundShape* collisionShape = new btCompoundShape{};
+    for(size_t i = 0; i < parts.size(); ++i)
+        collisionShape->addChildShape(transforms[i], parts[i]);
 
-	// And add it
-	addShapeToCompound(pShape, shape, spec);
+    return static_cast<btCompoundShape*>(cache.Insert(key, collisionShape, parts));
 }
 
 /**
- * Add a cylinder to the collision shape
+ * Get a box collision shape
  */
-void CBulletMultibodyLink::addCylinderToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec) {
+btCollisionShape* CBulletMultibodyLink::getBoxCollisionShape(CShapeCache& cache, GeometrySpecification& spec) {
+	// Bullet boxes take half extents
+    return cache.GetBox(0.5f * btVector3{spec.box.x, spec.box.y, spec.box.z});
+}
+
+/**
+ * Get a cylinder collision shape. Cylinders are defined from their base so the transform is moved up to bullet's
+ * centred cylinder, unless a hull (which can be built from the base) is requested.
+ */
+btCollisionShape* CBulletMultibodyLink::getCylinderCollisionShape(CBulletEngine& engine, GeometrySpecification& spec,
+                                                                  btTransform& transform) {
     // Extract the required properties
     float radius = spec.cylinder.radius;
     float length = spec.cylinder.length;
 
+    if(!engine.UseCylinderHulls())
+    {
+        transform = transform * btTransform{btQuaternion::getIdentity(), btVector3{0, 0, 0.5f * length}};
+        return engine.GetShapeCache().GetCylinderZ(btVector3{radius, radius, 0.5f * length});
+    }
+
+    int segments = engine.GetCylinderHullSegments();
+
+    std::ostringstream key;
+    key << std::setprecision(9) << "cylinderHull " << radius << " " << length << " " << segments;
+    if(btCollisionShape* existing = engine.GetShapeCache().Find(key.str()))
+        return existing;
+
     // Create an empty shape
     btConvexHullShape* shape = new btConvexHullShape{};
 
-    // Bottom
-    for(int i = 0; i < 360; ++i)
-      shape->addPoint(btVector3{(btScalar)(sin(i/(2*M_PI)) * radius), (btScalar)(cos(i/(2*M_PI)) * radius), 0}, false);
-
-    // Top
-    for(int i = 0; i < 360; ++i)
-      shape->addPoint(btVector3{(btScalar)(sin(i/(2*M_PI)) * radius), (btScalar)(cos(i/(2*M_PI)) * radius), length}, false);
+    // Bottom and top rings
+    for(int i = 0; i < segments; ++i)
+    {
+        btScalar angle = i * SIMD_2_PI / segments;
+        btScalar x = btSin(angle) * radius;
+        btScalar y = btCos(angle) * radius;
+        shape->addPoint(btVector3{x, y, 0}, false);
+        shape->addPoint(btVector3{x, y, length}, false);
+    }
 
     // Disabled this when adding points for efficiency, do it now
     shape->recalcLocalAabb();
-    
 
-    //    btCollisionShape* shape = new btCylinderShape{btVector3{spec.cylinder.radius, spec.cylinder.radius, 0.5f * spec.cylinder.length}};//, spec.cylinder.radius}};
-    
     // Minimise the collision margin
     shape->setMargin(COLLISION_MARGIN);
     
-	// And add it
-	addShapeToCompound(pShape, shape, spec);
+    return engine.GetShapeCache().Insert(key.str(), shape);
 }
 
 /**
- * Add a sphere to the provided collision shape
+ * Get a sphere collision shape
  */
-void CBulletMultibodyLink::addSphereToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec) {
-	// Build the shape
-    btCollisionShape* shape = new btSphereShape{spec.sphere.radius};
-
-	// And add it
-	addShapeToCompound(pShape, shape, spec);
+btCollisionShape* CBulletMultibodyLink::getSphereCollisionShape(CShapeCache& cache, GeometrySpecification& spec) {
+    return cache.GetSphere(spec.sphere.radius);
 }
 
 /**
- * Add a mesh to the collision shape
+ * Get a mesh collision shape. This may, itself, be built up of multiple sub shapes.
  */
-void CBulletMultibodyLink::addMeshToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec) {
+btCollisionShape* CBulletMultibodyLink::getMeshCollisionShape(CBulletEngine& engine, GeometrySpecification& spec) {
+    btVector3 scale{spec.mesh.sx, spec.mesh.sy, spec.mesh.sz};
+
+    // Meshes decomposed when their entity was loaded already are a handful of scaled hulls
+    if(spec.mesh.decomposition)
+        return engine.GetShapeCache().GetDecomposition(*spec.mesh.decomposition, COLLISION_MARGIN);
+
+	// Reduced hulls are far cheaper to query than every vertex of the original mesh
+    if(engine.GetMeshHullVertices() > 0)
+        return engine.GetShapeCache().GetMeshHulls(*spec.mesh.mesh, scale, COLLISION_MARGIN, engine.GetMeshHullVertices());
 
-	// This may, itself, be built up of multiple sub shapes
-    btCompoundShape *meshShape = new btCompoundShape;
+	// Each scale of a mesh is a separate shape but they all share the same triangle data
+    return engine.GetShapeCache().GetMesh(*spec.mesh.mesh, scale, COLLISION_MARGIN);
+}
+
+/**
+ * Collide through a btMultiBodyLinkCollider at the given link of a btMultiBody
+ */
+void CBulletMultibodyLink::AttachToMultiBody(btMultiBody* multiBody, int index, CBulletMultibodyEntity* owner) {
+    this->multiBody = multiBody;
+    this->multiBodyIndex = index;
+    this->owner = owner;
+
+    const Link& link = entity->getCurrentState();
+    collider = new btMultiBodyLinkCollider{multiBody, index};
+    collider->setCollisionShape(collisionShape);
+    collider->setFriction(link.collisionMaterial.properties.friction);
+    collider->setRestitution(1-link.collisionMaterial.properties.dampening);
+
+    // A fixed base never moves so collides like any other static body
+    if(index < 0 && multiBody->hasFixedBase())
+        collider->setCollisionFlags(collider->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
+
+    if(index < 0)
+        multiBody->setBaseCollider(collider);
+    else
+        multiBody->getLink(index).m_collider = collider;
+}
 
-	// Get the mesh info
-    auto& meshInfo = *spec.mesh.mesh;
+/**
+ * Our collider if we are part of a btMultiBody, otherwise our rigid body
+ */
+btCollisionObject* CBulletMultibodyLink::GetCollisionObject() const {
+    if(collider)
+        return collider;
+    return rigidBody;
+}
 
-	// For every sub-shape in the mesh
-    for(auto key : meshInfo.keys)
+/**
+ * Colliders are added as plain collision objects, the btMultiBody they belong to moves them
+ */
+void CBulletMultibodyLink::AddToEngine(CBulletEngine& engine) {
+    if(!collider)
     {
-		// Create an accessor for the trimesh data
-        btTriangleIndexVertexArray *vert
-                = new btTriangleIndexVertexArray((int)meshInfo.numIndices[key] / 3, meshInfo.indicesMap[key],
-                                                 3 * sizeof(int), (int)meshInfo.numVerts[key], meshInfo.vertsMap[key],
-                                                 3 * sizeof(float));
-
-		// Create the collision sub-shape
-//        btGImpactMeshShape *shape = new btGImpactMeshShape {vert};
-//	btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape{vert,false,true};
-	btConvexTriangleMeshShape* shape = new btConvexTriangleMeshShape{vert};
-
-		// Set its scale factor and update its bounds
-        shape->setLocalScaling(btVector3{1, 1, 1});
-//        shape->updateBound();
-    	shape->setMargin(COLLISION_MARGIN);
-/*
-	btCompoundShape* newCompound = btCreateCompoundFromGimpactShape(shape, 0);
-        newCompound->setLocalScaling(btVector3{1, 1, 1});
-//        newCompound->updateBound();
-newCompound->setMargin(COLLISION_MARGIN);*/
-	
-		// Add the sub-shape to the mesh with not transformation
-        meshShape->addChildShape(btTransform{btQuaternion{0,0,0}, btVector3{0, 0, 0}}, shape);
+        CBulletModel::AddToEngine(engine);
+        return;
     }
 
-	// Scale the mesh by the specified amount
-	meshShape->setLocalScaling(btVector3{spec.mesh.sx, spec.mesh.sy, spec.mesh.sz});
-	meshShape->setMargin(COLLISION_MARGIN);
-	
-	// And add it to the main compound shape
-	addShapeToCompound(pShape, meshShape, spec);
+    bool isStatic = collider->isStaticObject();
+    engine.GetBulletWorld()->addCollisionObject(collider, CBulletEngine::GetObjectGroup(isStatic), CBulletEngine::GetObjectCollisionFlags(isStatic));
+}
+
+/**
+ * Where the base link goes the rest of the multibody follows
+ */
+CEntity* CBulletMultibodyLink::GetTransferEntity() {
+    if(!owner || owner->GetBaseLink() != this)
+        return nullptr;
+    return &GetEmbodiedEntity().GetRootEntity();
 }
 
 /**
  * Update the physics model from the ARGoS entity
  */
 void CBulletMultibodyLink::UpdateFromEntityStatus() {
-	position = entity->GetEmbodiedEntity().GetOriginAnchor().Position;
-	orientation = entity->GetEmbodiedEntity().GetOriginAnchor().Orientation;
+	const SAnchor& anchor = entity->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceAt(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Move the link to the given anchor pose, or the whole btMultiBody if this is its base
+ */
+void CBulletMultibodyLink::PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) {
+	position = anchorPosition;
+	orientation = anchorOrientation;
+
+	// A btMultiBody is placed as a whole from its base and joint positions
+	if(multiBody)
+	{
+		if(multiBodyIndex < 0)
+			owner->PlaceBase(position, orientation);
+		return;
+	}
+
 	rigidBody->setWorldTransform(bulletTransformFromARGoS(position, orientation));
 }
 
@@ -221,7 +309,7 @@ void CBulletMultibodyLink::UpdateFromEntityStatus() {
  * Update the ARGoS entity from the physics model
  */
 void CBulletMultibodyLink::UpdateEntityStatus() {
-	bulletTransformToARGoS(rigidBody->getWorldTransform(), position, orientation);
+	bulletTransformToARGoS(GetCollisionObject()->getWorldTransform(), position, orientation);
 	entity->GetEmbodiedEntity().GetOriginAnchor().Position = position;
 	entity->GetEmbodiedEntity().GetOriginAnchor().Orientation = orientation;
 }
@@ -231,7 +319,7 @@ void CBulletMultibodyLink::UpdateEntityStatus() {
  */
 void CBulletMultibodyLink::CalculateBoundingBox() {
     btVector3 min, max;
-    GetRigidBody()->getAabb(min, max);
+    GetCollisionObject()->getCollisionShape()->getAabb(GetCollisionObject()->getWorldTransform(), min, max);
     GetBoundingBox().MinCorner.Set(min.getX(), min.getY(), min.getZ());
     GetBoundingBox().MaxCorner.Set(max.getX(), max.getY(), max.getZ());
 }
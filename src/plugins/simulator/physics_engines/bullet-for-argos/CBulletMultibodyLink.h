@@ -7,8 +7,15 @@
 
 #include "CBulletModel.h"
 #include "CMultibodyLinkEntity.h"
+#include "./bullet/src/LinearMath/btVector3.h"
 
 class btCompoundShape;
+class btCollisionShape;
+class btTransform;
+class btMultiBody;
+class btMultiBodyLinkCollider;
+class CShapeCache;
+class CBulletMultibodyEntity;
 
 /**
  * A single part of a multibodied entity
@@ -19,10 +26,20 @@ private:
     CMultibodyLinkEntity* entity;				// ARGoS entity
     CBulletEngine* engine;					// Our world engine
 
-    void addBoxToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec);
-    void addCylinderToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec);
-    void addSphereToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec);
-    void addMeshToCollisionShape(btCompoundShape *pShape, GeometrySpecification& spec);
+    btCompoundShape* collisionShape;			// Shared with identical links
+    btScalar mass;
+    btVector3 localInertia;
+
+    btMultiBody* multiBody{nullptr};				// Reduced coordinate body we are part of, if any
+    int multiBodyIndex{-1};						// Our link in it, -1 for its base
+    btMultiBodyLinkCollider* collider{nullptr};	// Collides for us instead of a rigid body inside a btMultiBody
+    CBulletMultibodyEntity* owner{nullptr};		// Our multibody, which rebuilds its btMultiBody when ARGoS moves it
+
+    static btCompoundShape* getCollisionShape(CBulletEngine& engine, const Link& link);
+    static btCollisionShape* getBoxCollisionShape(CShapeCache& cache, GeometrySpecification& spec);
+    static btCollisionShape* getCylinderCollisionShape(CBulletEngine& engine, GeometrySpecification& spec, btTransform& transform);
+    static btCollisionShape* getSphereCollisionShape(CShapeCache& cache, GeometrySpecification& spec);
+    static btCollisionShape* getMeshCollisionShape(CBulletEngine& engine, GeometrySpecification& spec);
 
 public:
     CBulletMultibodyLink(CBulletEngine& engine, CMultibodyLinkEntity & entity);
@@ -30,6 +47,7 @@ public:
 
     // To keep the worlds in sync
     virtual void UpdateFromEntityStatus() override;
+    virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) override;
     virtual void UpdateEntityStatus() override;
 
     // Execute physics
@@ -39,6 +57,24 @@ public:
     virtual bool CheckIntersectionWithRay(Real& f_t_on_ray, const CRay3& ray) const;
 
     virtual btRigidBody* GetRigidBody() const { return rigidBody; }
+    virtual btCollisionObject* GetCollisionObject() const override;
+
+    virtual void AddToEngine(CBulletEngine& engine) override;
+
+    // Only the base link decides which engine the whole multibody belongs to
+    virtual CEntity* GetTransferEntity() override;
+
+    // The multibody entity this is a link of
+    void SetOwner(CBulletMultibodyEntity* owner) { this->owner = owner; }
+
+    // Become link index (or the base at -1) of a btMultiBody instead of a free rigid body
+    void AttachToMultiBody(btMultiBody* multiBody, int index, CBulletMultibodyEntity* owner);
+
+    btMultiBody* GetMultiBody() const { return multiBody; }
+    int GetMultiBodyIndex() const { return multiBodyIndex; }
+    btScalar GetMass() const { return mass; }
+    const btVector3& GetLocalInertia() const { return localInertia; }
+    CMultibodyLinkEntity* GetEntity() const { return entity; }
 };
 
 #endif //ARGOS3_BULLET_CBULLETBOXMODEL_H
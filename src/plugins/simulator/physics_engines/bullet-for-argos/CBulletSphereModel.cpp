@@ -6,6 +6,7 @@
 #include "CBulletSphereModel.h"
 
 #include "transform_utils.h"
+#include "CShapeCache.h"
 /**
  * A simple sphere model for the bullet engine - Friction, rolling friction and restitution all set to 0.5
  */
@@ -17,7 +18,7 @@ CBulletSphereModel::CBulletSphereModel(CBulletEngine &engine, CSphereEntity &ent
 	this->engine = &engine;
 
 	// Bullet requires boxes to be initialised with half side lengths
-	collisionShape = new btSphereShape{(btScalar)entity.GetRadius()};
+	collisionShape = engine.GetShapeCache().GetSphere((btScalar)entity.GetRadius());
 
 	// Setup the location of the box in bullet compensating for the difference between ARGoS and Bullet coordinate origins
 	position = entity.GetEmbodiedEntity().GetOriginAnchor().Position;
@@ -33,7 +34,7 @@ CBulletSphereModel::CBulletSphereModel(CBulletEngine &engine, CSphereEntity &ent
 	collisionShape->calculateLocalInertia(mass, inertia);
 
 	rigidBody = new btRigidBody{mass, motionState, collisionShape, inertia};
-	rigidBody->setActivationState(DISABLE_DEACTIVATION);
+	engine.ConfigureActivation(*rigidBody);
 
 	rigidBody->setFriction(0.5);
 	rigidBody->setRestitution(0.5);
@@ -47,8 +48,17 @@ CBulletSphereModel::CBulletSphereModel(CBulletEngine &engine, CSphereEntity &ent
  */
 void CBulletSphereModel::UpdateFromEntityStatus()
 {
-	position = entity->GetEmbodiedEntity().GetOriginAnchor().Position + rotateARGoSVector(positionOffset, orientation);
-	orientation = entity->GetEmbodiedEntity().GetOriginAnchor().Orientation;
+	const SAnchor& anchor = entity->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceAt(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Move the body to where the given anchor pose puts it
+ */
+void CBulletSphereModel::PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation)
+{
+	orientation = anchorOrientation;
+	position = anchorPosition + rotateARGoSVector(positionOffset, orientation);
 	rigidBody->setWorldTransform(bulletTransformFromARGoS(position, orientation));
 }
 
@@ -26,6 +26,7 @@ public:
 	virtual ~CBulletSphereModel() {}
 
 	virtual void UpdateFromEntityStatus() override;
+	virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) override;
 	virtual void UpdateEntityStatus() override;
 	virtual void Step() override {}
 
@@ -0,0 +1,73 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CBulletStaticMeshModel.h"
+
+#include "./bullet/src/btBulletDynamicsCommon.h"
+#include "transform_utils.h"
+#include "CShapeCache.h"
+
+/**
+ * Creates a static mesh in the world, its BVH comes from the asset cache whenever the mesh has been used before
+ */
+CBulletStaticMeshModel::CBulletStaticMeshModel(CBulletEngine& engine, CStaticMeshEntity& entity)
+		: CBulletModel(engine, entity.GetEmbodiedEntity())
+{
+	// Retain a reference to the associated ARGoS entity
+	this->entity = &entity;
+
+	// The scale is baked into the BVH so the world scale is applied there too
+	CVector3 scale = entity.GetScale() * engine.worldScale;
+	collisionShape = engine.GetShapeCache().GetStaticMesh(entity.GetMesh(),
+														  btVector3{(btScalar)scale.GetX(), (btScalar)scale.GetY(), (btScalar)scale.GetZ()});
+
+	// Place the mesh, its origin is the same in ARGoS and bullet
+	btTransform t = bulletTransformFromARGoS(position, orientation);
+	motionState = new btDefaultMotionState{t};
+
+	// Triangle meshes can only ever be static
+	rigidBody = new btRigidBody{0, motionState, collisionShape, btVector3{0, 0, 0}};
+	engine.ConfigureActivation(*rigidBody);
+
+	rigidBody->setFriction(0.5);
+	rigidBody->setRestitution(0.5);
+
+	CalculateBoundingBox();
+}
+
+/**
+ * Update the AABB from the mesh's bounds in the global coordinate frame
+ */
+void CBulletStaticMeshModel::CalculateBoundingBox()
+{
+	btVector3 aabbMin, aabbMax;
+	rigidBody->getCollisionShape()->getAabb(rigidBody->getWorldTransform(), aabbMin, aabbMax);
+	aabbMin *= engine->inverseWorldScale;
+	aabbMax *= engine->inverseWorldScale;
+
+	GetBoundingBox().MinCorner.Set(aabbMin.x(), aabbMin.y(), aabbMin.z());
+	GetBoundingBox().MaxCorner.Set(aabbMax.x(), aabbMax.y(), aabbMax.z());
+}
+
+/**
+ * Only needed when the mesh is moved by hand
+ */
+void CBulletStaticMeshModel::UpdateFromEntityStatus()
+{
+	const SAnchor& anchor = entity->GetEmbodiedEntity().GetOriginAnchor();
+	PlaceAt(anchor.Position, anchor.Orientation);
+}
+
+/**
+ * Move the mesh to the given anchor pose
+ */
+void CBulletStaticMeshModel::PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation)
+{
+	position = anchorPosition*engine->worldScale;
+	orientation = anchorOrientation;
+	rigidBody->setWorldTransform(bulletTransformFromARGoS(position, orientation));
+	CalculateBoundingBox();
+}
+
+REGISTER_BULLET_ENTITY_OPS(CStaticMeshEntity, CBulletStaticMeshModel);
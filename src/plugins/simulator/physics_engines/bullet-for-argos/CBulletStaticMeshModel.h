@@ -0,0 +1,40 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CBULLETSTATICMESHMODEL_H
+#define ARGOS3_BULLET_CBULLETSTATICMESHMODEL_H
+
+class btBvhTriangleMeshShape;
+
+#include "CBulletModel.h"
+#include "CStaticMeshEntity.h"
+
+/**
+ * Immovable triangle mesh backed by a cached BVH
+ */
+class CBulletStaticMeshModel : public CBulletModel
+{
+private:
+	CStaticMeshEntity* entity;					// ARGoS entity
+	btBvhTriangleMeshShape* collisionShape;		// Shared through the engine's shape cache
+	btMotionState* motionState;					// Motion info
+
+public:
+	CBulletStaticMeshModel(CBulletEngine& engine, CStaticMeshEntity& entity);
+	virtual ~CBulletStaticMeshModel() {}
+
+	// To keep the worlds in sync
+	virtual void UpdateFromEntityStatus() override;
+	virtual void PlaceAt(const CVector3& anchorPosition, const CQuaternion& anchorOrientation) override;
+	virtual void UpdateEntityStatus() override {}
+
+	// Execute physics
+	virtual void Step() override {}
+
+	virtual void CalculateBoundingBox() override;
+
+	virtual btRigidBody* GetRigidBody() const { return rigidBody; }
+};
+
+#endif //ARGOS3_BULLET_CBULLETSTATICMESHMODEL_H
@@ -67,7 +67,9 @@ public:
 	float GetEffortMax() { return effortMax; }
 
 	float GetVelocityTarget() { return velocityTarget; }
+	void RestoreVelocityTarget(float velocity) { velocityTarget = velocity; }	// Bypasses the input mapping (checkpoints)
 	void SetPositionCurrent(float pos) { positionCurrent = pos; }
+	float GetPositionCurrent() { return positionCurrent; }
 
 	CEmbodiedEntity& GetEmbodiedEntity(){ return *embodiedEntity; }
 
@@ -147,17 +147,14 @@ void CMultibodyEntity::Reset()
 	if(controllableEntity)
 		controllableEntity->Reset();
 
+	// Every link once, the root included, the physics engine restores its own state separately
 	for(auto& pair : links)
 		pair.second->Reset();
 
-	for(auto& pair : links)
-		dynamic_cast<CEntity*>(pair.second)->Reset();
-
 	UpdateComponents();
 
 	if(rootLink)
 	{
-		rootLink->Reset();
 		auto& rootAnchor = rootLink->GetEmbodiedEntity().GetOriginAnchor();
 		rootAnchor.Position += GetEmbodiedEntity().GetOriginAnchor().Position;
 		rootAnchor.Orientation = combineARGoSQuaternions(GetEmbodiedEntity().GetOriginAnchor().Orientation, rootAnchor.Orientation);
@@ -0,0 +1,308 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CParallelCollisionDispatcher.h"
+#include "LinearMath/btPoolAllocator.h"
+
+#include <algorithm>
+
+extern int gNumManifold;
+
+/**
+ * Pairs are handed to threads in chunks of this size to keep contention on the pool counter low
+ */
+static const int PAIRS_PER_TASK = 32;
+
+/**
+ * Below this many pairs waking the workers costs more than it saves
+ */
+static const int MIN_PARALLEL_PAIRS = 64;
+
+/**
+ * Elements in each per-thread pool, anything beyond this falls back to the heap
+ */
+static const int THREAD_POOL_SIZE = 1024;
+
+/**
+ * Which dispatcher, thread and pair the current thread is working on. Only set while dispatching in parallel.
+ */
+static thread_local CParallelCollisionDispatcher* activeDispatcher = nullptr;
+static thread_local unsigned int activeThreadIndex = 0;
+static thread_local int activePairIndex = -1;
+
+/**
+ * Create the per-thread pools, sized to match the shared pools handed out by the collision configuration
+ */
+CParallelCollisionDispatcher::CParallelCollisionDispatcher(btCollisionConfiguration* collisionConfiguration, WorkerPool& pool)
+		: btCollisionDispatcher(collisionConfiguration), pool(&pool)
+{
+	threadContexts.resize(pool.GetNumThreads());
+	for(auto& context : threadContexts)
+	{
+		context.algorithmPool = new btPoolAllocator{m_collisionAlgorithmPoolAllocator->getElementSize(), THREAD_POOL_SIZE};
+		context.manifoldPool = new btPoolAllocator{sizeof(btPersistentManifold), THREAD_POOL_SIZE};
+	}
+}
+
+/**
+ * Release the per-thread pools
+ */
+CParallelCollisionDispatcher::~CParallelCollisionDispatcher()
+{
+	for(auto& context : threadContexts)
+	{
+		delete context.algorithmPool;
+		delete context.manifoldPool;
+	}
+}
+
+/**
+ * Run the near callback of every overlapping pair across the pool, then apply the manifold changes in pair order
+ */
+void CParallelCollisionDispatcher::dispatchAllCollisionPairs(btOverlappingPairCache* pairCache,
+															 const btDispatcherInfo& dispatchInfo,
+															 btDispatcher* dispatcher)
+{
+	btBroadphasePairArray& pairs = pairCache->getOverlappingPairArray();
+	int numPairs = pairs.size();
+	bool serial = numPairs < MIN_PARALLEL_PAIRS || pool->GetNumThreads() == 1;
+
+	// Continuous queries write to shared bodies and deferred removal caches may drop pairs, use the serial path.
+	// Deterministic runs keep the canonical order even when serial so changing thread count never changes results.
+	if((serial && !deterministic) || pairCache->hasDeferredRemoval() ||
+	   dispatchInfo.m_dispatchFunc != btDispatcherInfo::DISPATCH_DISCRETE)
+	{
+		btCollisionDispatcher::dispatchAllCollisionPairs(pairCache, dispatchInfo, dispatcher);
+		return;
+	}
+
+	if(deterministic)
+		SortPairs(pairs);
+
+	btNearCallback nearCallback = getNearCallback();
+	int numTasks = (numPairs + PAIRS_PER_TASK - 1) / PAIRS_PER_TASK;
+
+	auto dispatchTask = [&](int task, unsigned int threadIndex)
+	{
+		activeDispatcher = this;
+		activeThreadIndex = threadIndex;
+
+		int end = std::min(numPairs, (task + 1) * PAIRS_PER_TASK);
+		for(int i = task * PAIRS_PER_TASK; i < end; ++i)
+		{
+			activePairIndex = i;
+			nearCallback(pairs[deterministic ? pairOrder[i] : i], *this, dispatchInfo);
+		}
+
+		activeDispatcher = nullptr;
+	};
+
+	if(serial)
+	{
+		for(int task = 0; task < numTasks; ++task)
+			dispatchTask(task, 0);
+	}
+	else
+		pool->ParallelFor(numTasks, dispatchTask);
+
+	ReplayManifoldLogs();
+}
+
+/**
+ * Order the pairs by the unique ids of their proxies, which only depend on the order objects were added
+ */
+void CParallelCollisionDispatcher::SortPairs(const btBroadphasePairArray& pairs)
+{
+	pairOrder.resize(pairs.size());
+	for(int i = 0; i < pairs.size(); ++i)
+		pairOrder[i] = i;
+
+	std::sort(pairOrder.begin(), pairOrder.end(), [&](int a, int b)
+	{
+		const btBroadphasePair& pairA = pairs[a];
+		const btBroadphasePair& pairB = pairs[b];
+		if(pairA.m_pProxy0->m_uniqueId != pairB.m_pProxy0->m_uniqueId)
+			return pairA.m_pProxy0->m_uniqueId < pairB.m_pProxy0->m_uniqueId;
+		return pairA.m_pProxy1->m_uniqueId < pairB.m_pProxy1->m_uniqueId;
+	});
+}
+
+/**
+ * Apply every logged manifold change in the order the serial dispatcher would have made them
+ */
+void CParallelCollisionDispatcher::ReplayManifoldLogs()
+{
+	mergedLog.clear();
+	for(auto& context : threadContexts)
+	{
+		mergedLog.insert(mergedLog.end(), context.manifoldLog.begin(), context.manifoldLog.end());
+		context.manifoldLog.clear();
+	}
+
+	// A pair is only ever handled by one thread so a stable sort keeps its operations in order
+	std::stable_sort(mergedLog.begin(), mergedLog.end(), [](const ManifoldOperation& a, const ManifoldOperation& b)
+	{
+		return a.pairIndex < b.pairIndex;
+	});
+
+	for(auto& operation : mergedLog)
+	{
+		btPersistentManifold* manifold = operation.manifold;
+
+		if(operation.isNew)
+		{
+			gNumManifold++;
+			manifold->m_index1a = m_manifoldsPtr.size();
+			m_manifoldsPtr.push_back(manifold);
+		}
+		else
+		{
+			gNumManifold--;
+			int findIndex = manifold->m_index1a;
+			m_manifoldsPtr.swap(findIndex, m_manifoldsPtr.size() - 1);
+			m_manifoldsPtr[findIndex]->m_index1a = findIndex;
+			m_manifoldsPtr.pop_back();
+
+			manifold->~btPersistentManifold();
+			FreeManifoldMemory(manifold);
+		}
+	}
+
+	// Now nobody is allocating we can return algorithms to other threads' pools
+	for(auto& context : threadContexts)
+	{
+		for(void* ptr : context.deferredAlgorithmFrees)
+			FreeAlgorithmMemory(ptr);
+		context.deferredAlgorithmFrees.clear();
+	}
+}
+
+/**
+ * Create a manifold from the calling thread's pool and log its addition to the manifold array
+ */
+btPersistentManifold* CParallelCollisionDispatcher::getNewManifold(const btCollisionObject* b0, const btCollisionObject* b1)
+{
+	if(activeDispatcher != this)
+		return btCollisionDispatcher::getNewManifold(b0, b1);
+
+	ThreadContext& context = threadContexts[activeThreadIndex];
+
+	// Same thresholds as btCollisionDispatcher
+	btScalar contactBreakingThreshold = (m_dispatcherFlags & btCollisionDispatcher::CD_USE_RELATIVE_CONTACT_BREAKING_THRESHOLD) ?
+		btMin(b0->getCollisionShape()->getContactBreakingThreshold(gContactBreakingThreshold), b1->getCollisionShape()->getContactBreakingThreshold(gContactBreakingThreshold))
+		: gContactBreakingThreshold;
+	btScalar contactProcessingThreshold = btMin(b0->getContactProcessingThreshold(), b1->getContactProcessingThreshold());
+
+	void* mem = context.manifoldPool->getFreeCount() ? context.manifoldPool->allocate(sizeof(btPersistentManifold))
+													 : btAlignedAlloc(sizeof(btPersistentManifold), 16);
+
+	btPersistentManifold* manifold = new(mem) btPersistentManifold{b0, b1, 0, contactBreakingThreshold, contactProcessingThreshold};
+	context.manifoldLog.push_back(ManifoldOperation{activePairIndex, true, manifold});
+
+	return manifold;
+}
+
+/**
+ * Clear the manifold now but leave removing it from the manifold array until the replay
+ */
+void CParallelCollisionDispatcher::releaseManifold(btPersistentManifold* manifold)
+{
+	clearManifold(manifold);
+
+	if(activeDispatcher == this)
+	{
+		threadContexts[activeThreadIndex].manifoldLog.push_back(ManifoldOperation{activePairIndex, false, manifold});
+		return;
+	}
+
+	gNumManifold--;
+	int findIndex = manifold->m_index1a;
+	m_manifoldsPtr.swap(findIndex, m_manifoldsPtr.size() - 1);
+	m_manifoldsPtr[findIndex]->m_index1a = findIndex;
+	m_manifoldsPtr.pop_back();
+
+	manifold->~btPersistentManifold();
+	FreeManifoldMemory(manifold);
+}
+
+/**
+ * Allocate from the calling thread's pool while dispatching, otherwise the shared pool
+ */
+void* CParallelCollisionDispatcher::allocateCollisionAlgorithm(int size)
+{
+	if(activeDispatcher != this)
+		return btCollisionDispatcher::allocateCollisionAlgorithm(size);
+
+	btPoolAllocator* algorithmPool = threadContexts[activeThreadIndex].algorithmPool;
+	if(algorithmPool->getFreeCount() && size <= algorithmPool->getElementSize())
+		return algorithmPool->allocate(size);
+
+	return btAlignedAlloc(static_cast<size_t>(size), 16);
+}
+
+/**
+ * Free straight away if the memory is ours, otherwise wait until the threads are idle
+ */
+void CParallelCollisionDispatcher::freeCollisionAlgorithm(void* ptr)
+{
+	if(activeDispatcher != this)
+	{
+		FreeAlgorithmMemory(ptr);
+		return;
+	}
+
+	ThreadContext& context = threadContexts[activeThreadIndex];
+	if(context.algorithmPool->validPtr(ptr))
+	{
+		context.algorithmPool->freeMemory(ptr);
+		return;
+	}
+
+	// Pools are never resized so checking ownership is safe, freeing into them is not
+	bool pooled = m_collisionAlgorithmPoolAllocator->validPtr(ptr);
+	for(auto& other : threadContexts)
+		pooled = pooled || other.algorithmPool->validPtr(ptr);
+
+	if(pooled)
+		context.deferredAlgorithmFrees.push_back(ptr);
+	else
+		btAlignedFree(ptr);
+}
+
+/**
+ * Return algorithm memory to whichever pool owns it
+ */
+void CParallelCollisionDispatcher::FreeAlgorithmMemory(void* ptr)
+{
+	for(auto& context : threadContexts)
+	{
+		if(context.algorithmPool->validPtr(ptr))
+		{
+			context.algorithmPool->freeMemory(ptr);
+			return;
+		}
+	}
+
+	btCollisionDispatcher::freeCollisionAlgorithm(ptr);
+}
+
+/**
+ * Return manifold memory to whichever pool owns it
+ */
+void CParallelCollisionDispatcher::FreeManifoldMemory(btPersistentManifold* manifold)
+{
+	for(auto& context : threadContexts)
+	{
+		if(context.manifoldPool->validPtr(manifold))
+		{
+			context.manifoldPool->freeMemory(manifold);
+			return;
+		}
+	}
+
+	if(m_persistentManifoldPoolAllocator->validPtr(manifold))
+		m_persistentManifoldPoolAllocator->freeMemory(manifold);
+	else
+		btAlignedFree(manifold);
+}
@@ -0,0 +1,77 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CPARALLELCOLLISIONDISPATCHER_H
+#define ARGOS3_BULLET_CPARALLELCOLLISIONDISPATCHER_H
+
+#include "./bullet/src/btBulletCollisionCommon.h"
+#include "WorkerPool.h"
+
+#include <vector>
+
+class btPoolAllocator;
+
+/**
+ * A collision dispatcher which runs the narrowphase of every overlapping pair across a worker pool.
+ *
+ * Each thread allocates algorithms and manifolds from its own pools so no global lock is taken.
+ * Changes to the shared manifold array are logged per pair and replayed in pair order once all
+ * threads are done, leaving the manifold array exactly as the serial dispatcher would.
+ * In deterministic mode pairs are visited in order of their proxies' unique ids rather than
+ * the pair cache's order, so the manifold array no longer depends on the cache's history.
+ */
+class CParallelCollisionDispatcher : public btCollisionDispatcher
+{
+public:
+	CParallelCollisionDispatcher(btCollisionConfiguration* collisionConfiguration, WorkerPool& pool);
+	virtual ~CParallelCollisionDispatcher();
+
+	virtual void dispatchAllCollisionPairs(btOverlappingPairCache* pairCache, const btDispatcherInfo& dispatchInfo,
+										   btDispatcher* dispatcher) override;
+
+	virtual btPersistentManifold* getNewManifold(const btCollisionObject* b0, const btCollisionObject* b1) override;
+	virtual void releaseManifold(btPersistentManifold* manifold) override;
+
+	virtual void* allocateCollisionAlgorithm(int size) override;
+	virtual void freeCollisionAlgorithm(void* ptr) override;
+
+	// Visit pairs in a canonical order whatever the pair cache or thread count
+	void SetDeterministic(bool deterministic) { this->deterministic = deterministic; }
+
+private:
+	/**
+	 * A change to the manifold array made while dispatching a pair
+	 */
+	struct ManifoldOperation
+	{
+		int pairIndex;
+		bool isNew;						// Otherwise it is a release
+		btPersistentManifold* manifold;
+	};
+
+	/**
+	 * Everything owned by a single worker thread
+	 */
+	struct ThreadContext
+	{
+		btPoolAllocator* algorithmPool;
+		btPoolAllocator* manifoldPool;
+		std::vector<ManifoldOperation> manifoldLog;
+		std::vector<void*> deferredAlgorithmFrees;		// Algorithms living in another thread's pool
+	};
+
+	void SortPairs(const btBroadphasePairArray& pairs);
+	void ReplayManifoldLogs();
+	void FreeAlgorithmMemory(void* ptr);
+	void FreeManifoldMemory(btPersistentManifold* manifold);
+
+	WorkerPool* pool;
+	std::vector<ThreadContext> threadContexts;
+	std::vector<ManifoldOperation> mergedLog;
+
+	bool deterministic{false};
+	std::vector<int> pairOrder;					// Pair indices in canonical order, deterministic mode only
+};
+
+#endif //ARGOS3_BULLET_CPARALLELCOLLISIONDISPATCHER_H
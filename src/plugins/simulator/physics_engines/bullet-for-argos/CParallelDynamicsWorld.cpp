@@ -0,0 +1,222 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CParallelDynamicsWorld.h"
+
+#include <algorithm>
+
+/**
+ * Island a constraint belongs to, mirrors the rule used by btDiscreteDynamicsWorld
+ */
+static inline int getConstraintIslandId(const btTypedConstraint* constraint)
+{
+	const btCollisionObject& bodyA = constraint->getRigidBodyA();
+	const btCollisionObject& bodyB = constraint->getRigidBodyB();
+	return bodyA.getIslandTag() >= 0 ? bodyA.getIslandTag() : bodyB.getIslandTag();
+}
+
+/**
+ * Sort predicate to group constraints by island
+ */
+struct SortConstraintOnIslandPredicate
+{
+	bool operator()(const btTypedConstraint* lhs, const btTypedConstraint* rhs) const
+	{
+		return getConstraintIslandId(lhs) < getConstraintIslandId(rhs);
+	}
+};
+
+/**
+ * Order of a manifold within its island, by the unique ids of the bodies it is between
+ */
+struct SortManifoldOnBodiesPredicate
+{
+	static inline std::pair<int, int> key(const btPersistentManifold* manifold)
+	{
+		int id0 = manifold->getBody0()->getBroadphaseHandle()->m_uniqueId;
+		int id1 = manifold->getBody1()->getBroadphaseHandle()->m_uniqueId;
+		return std::make_pair(std::min(id0, id1), std::max(id0, id1));
+	}
+
+	bool operator()(const btPersistentManifold* lhs, const btPersistentManifold* rhs) const
+	{
+		return key(lhs) < key(rhs);
+	}
+};
+
+/**
+ * Create one solver for each thread in the pool
+ */
+CParallelDynamicsWorld::CParallelDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* pairCache,
+											   btConstraintSolver* constraintSolver,
+											   btCollisionConfiguration* collisionConfiguration, WorkerPool& pool)
+		: btDiscreteDynamicsWorld(dispatcher, pairCache, constraintSolver, collisionConfiguration), pool(&pool)
+{
+	for(unsigned int i = 0; i < pool.GetNumThreads(); ++i)
+		threadSolvers.push_back(new btSequentialImpulseConstraintSolver);
+
+	collector.world = this;
+}
+
+/**
+ * Release the per-thread solvers, everything else belongs to the engine
+ */
+CParallelDynamicsWorld::~CParallelDynamicsWorld()
+{
+	for(auto islandSolver : threadSolvers)
+		delete islandSolver;
+}
+
+/**
+ * Reset the per-thread solvers, the main solver belongs to the engine
+ */
+void CParallelDynamicsWorld::ResetSolvers()
+{
+	for(auto islandSolver : threadSolvers)
+		islandSolver->reset();
+}
+
+/**
+ * Record an island. The body array is reused by the island manager so it must be copied.
+ */
+void CParallelDynamicsWorld::IslandCollector::processIsland(btCollisionObject** bodies, int numBodies,
+															btPersistentManifold** manifolds, int numManifolds,
+															int islandId)
+{
+	Island island;
+	island.firstBody = world->islandBodies.size();
+	island.numBodies = numBodies;
+	island.firstManifold = world->islandManifolds.size();
+	island.numManifolds = numManifolds;
+	island.firstConstraint = 0;
+	island.numConstraints = 0;
+	island.islandId = islandId;
+	island.touchesKinematic = false;
+
+	for(int i = 0; i < numBodies; ++i)
+		world->islandBodies.push_back(bodies[i]);
+
+	for(int i = 0; i < numManifolds; ++i)
+	{
+		world->islandManifolds.push_back(manifolds[i]);
+
+		if(manifolds[i]->getBody0()->isKinematicObject() || manifolds[i]->getBody1()->isKinematicObject())
+			island.touchesKinematic = true;
+	}
+
+	world->islands.push_back(island);
+}
+
+/**
+ * Solve a single island with the provided solver
+ */
+void CParallelDynamicsWorld::SolveIsland(const Island& island, btSequentialImpulseConstraintSolver& islandSolver,
+										 btContactSolverInfo& solverInfo)
+{
+	// Randomised solver orders would otherwise carry on from whichever island this thread solved last
+	if(deterministic)
+		islandSolver.setRandSeed(0);
+
+	btCollisionObject** bodies = island.numBodies ? &islandBodies[island.firstBody] : nullptr;
+	btPersistentManifold** manifolds = island.numManifolds ? &islandManifolds[island.firstManifold] : nullptr;
+	btTypedConstraint** constraints = island.numConstraints ? &m_sortedConstraints[island.firstConstraint] : nullptr;
+
+	islandSolver.solveGroup(bodies, island.numBodies, manifolds, island.numManifolds,
+							constraints, island.numConstraints, solverInfo, m_debugDrawer, m_dispatcher1);
+}
+
+/**
+ * Copy the constraints sorted by island. Deterministic runs keep the order they were added in within each island.
+ */
+void CParallelDynamicsWorld::SortConstraints()
+{
+	m_sortedConstraints.resize(m_constraints.size());
+	for(int i = 0; i < m_constraints.size(); ++i)
+		m_sortedConstraints[i] = m_constraints[i];
+
+	if(!deterministic)
+	{
+		m_sortedConstraints.quickSort(SortConstraintOnIslandPredicate());
+		return;
+	}
+
+	if(m_sortedConstraints.size())
+		std::stable_sort(&m_sortedConstraints[0], &m_sortedConstraints[0] + m_sortedConstraints.size(),
+						 SortConstraintOnIslandPredicate());
+}
+
+/**
+ * The island manager groups manifolds with an unstable sort, put each island's back in body id order
+ */
+void CParallelDynamicsWorld::SortIslandManifolds()
+{
+	for(auto& island : islands)
+	{
+		if(island.numManifolds < 2)
+			continue;
+
+		btPersistentManifold** first = &islandManifolds[island.firstManifold];
+		std::stable_sort(first, first + island.numManifolds, SortManifoldOnBodiesPredicate());
+	}
+}
+
+/**
+ * Build the islands then solve them across the worker pool
+ */
+void CParallelDynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
+{
+	BT_PROFILE("solveConstraints");
+
+	// Without split islands everything arrives as one island, nothing to parallelise
+	if(!m_islandManager->getSplitIslands())
+	{
+		btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+		return;
+	}
+
+	// Group constraints by island as the serial world does
+	SortConstraints();
+
+	// Collect all awake islands
+	islands.clear();
+	islandBodies.resize(0);
+	islandManifolds.resize(0);
+	m_islandManager->buildAndProcessIslands(getDispatcher(), this, &collector);
+
+	if(deterministic)
+		SortIslandManifolds();
+
+	// Islands are reported in ascending id order, as are the sorted constraints, so match them in one pass
+	int constraintIdx = 0;
+	for(auto& island : islands)
+	{
+		while(constraintIdx < m_sortedConstraints.size() && getConstraintIslandId(m_sortedConstraints[constraintIdx]) < island.islandId)
+			++constraintIdx;
+
+		island.firstConstraint = constraintIdx;
+		while(constraintIdx < m_sortedConstraints.size() && getConstraintIslandId(m_sortedConstraints[constraintIdx]) == island.islandId)
+			++constraintIdx;
+		island.numConstraints = constraintIdx - island.firstConstraint;
+
+		// A kinematic body can join an island through a constraint without ever touching it
+		for(int i = island.firstConstraint; i < constraintIdx && !island.touchesKinematic; ++i)
+		{
+			const btTypedConstraint* constraint = m_sortedConstraints[i];
+			if(constraint->getRigidBodyA().isKinematicObject() || constraint->getRigidBodyB().isKinematicObject())
+				island.touchesKinematic = true;
+		}
+	}
+
+	// Solve every independent island concurrently
+	pool->ParallelFor((int)islands.size(), [&](int index, unsigned int threadIndex)
+	{
+		if(!islands[index].touchesKinematic)
+			SolveIsland(islands[index], *threadSolvers[threadIndex], solverInfo);
+	});
+
+	// Islands sharing a kinematic body would race on its solver body, do them here
+	for(auto& island : islands)
+		if(island.touchesKinematic)
+			SolveIsland(island, *threadSolvers[0], solverInfo);
+}
@@ -0,0 +1,83 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CPARALLELDYNAMICSWORLD_H
+#define ARGOS3_BULLET_CPARALLELDYNAMICSWORLD_H
+
+#include "./bullet/src/btBulletDynamicsCommon.h"
+#include "BulletCollision/CollisionDispatch/btSimulationIslandManager.h"
+#include "WorkerPool.h"
+
+#include <vector>
+
+/**
+ * A discrete dynamics world which solves independent simulation islands concurrently.
+ *
+ * Islands are built by the btSimulationIslandManager exactly as in the serial world,
+ * then handed to the worker pool where each thread owns its own sequential impulse
+ * solver. Islands never share a dynamic body so they can be solved without locking.
+ * In deterministic mode each island's manifolds and constraints are put in a canonical
+ * order and every solver starts from the same state, so results never depend on which
+ * thread solved an island or how many threads there are.
+ */
+ATTRIBUTE_ALIGNED16(class) CParallelDynamicsWorld : public btDiscreteDynamicsWorld
+{
+public:
+	BT_DECLARE_ALIGNED_ALLOCATOR();
+
+	CParallelDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* pairCache,
+						   btConstraintSolver* constraintSolver, btCollisionConfiguration* collisionConfiguration,
+						   WorkerPool& pool);
+	virtual ~CParallelDynamicsWorld();
+
+	// Solve islands in a canonical order whatever the thread count
+	void SetDeterministic(bool deterministic) { this->deterministic = deterministic; }
+
+	// Put every per-thread solver back to its initial state
+	void ResetSolvers();
+
+protected:
+	virtual void solveConstraints(btContactSolverInfo& solverInfo) override;
+
+private:
+	/**
+	 * A single island recorded by the island manager, stored as ranges into flat arrays
+	 */
+	struct Island
+	{
+		int firstBody, numBodies;
+		int firstManifold, numManifolds;
+		int firstConstraint, numConstraints;
+		int islandId;
+		bool touchesKinematic;		// Kinematic bodies are shared between islands so must be solved serially
+	};
+
+	/**
+	 * Copies each island handed out by the island manager so they can be solved later
+	 */
+	struct IslandCollector : public btSimulationIslandManager::IslandCallback
+	{
+		CParallelDynamicsWorld* world;
+
+		virtual void processIsland(btCollisionObject** bodies, int numBodies,
+								   btPersistentManifold** manifolds, int numManifolds, int islandId) override;
+	};
+
+	void SolveIsland(const Island& island, btSequentialImpulseConstraintSolver& islandSolver,
+					 btContactSolverInfo& solverInfo);
+	void SortConstraints();
+	void SortIslandManifolds();
+
+	WorkerPool* pool;
+	std::vector<btSequentialImpulseConstraintSolver*> threadSolvers;		// One per pool thread
+
+	IslandCollector collector;
+	std::vector<Island> islands;
+	btAlignedObjectArray<btCollisionObject*> islandBodies;
+	btAlignedObjectArray<btPersistentManifold*> islandManifolds;
+
+	bool deterministic{false};
+};
+
+#endif //ARGOS3_BULLET_CPARALLELDYNAMICSWORLD_H
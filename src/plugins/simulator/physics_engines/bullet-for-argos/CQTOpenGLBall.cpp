@@ -4,6 +4,7 @@
 
 #include "CQTOpenGLBall.h"
 #include "CSphereEntity.h"
+#include "CQTOpenGLPrimitives.h"
 #include <argos3/plugins/simulator/visualizations/qt-opengl/qtopengl_widget.h>
 
 using namespace argos;
@@ -25,9 +26,9 @@ CQTOpenGLBall::CQTOpenGLBall()
 	/* Reserve the needed display lists */
 	drawListId = glGenLists(1);
 
-	/* Make body list */
+	/* Make material list */
 	glNewList(drawListId, GL_COMPILE);
-	MakeBody();
+	MakeMaterial();
 	glEndList();
 }
 
@@ -39,11 +40,12 @@ CQTOpenGLBall::~CQTOpenGLBall() {
 }
 
 /**
- * Call the list with the appropriate colour/material set
+ * Set the appropriate colour/material and draw a sphere at a detail suited to its size on screen
  */
 void CQTOpenGLBall::Draw(const CSphereEntity & c_entity) {
 
 	// Set the appropriate visual properties
+	glCallList(drawListId);
 	if(c_entity.GetEmbodiedEntity().IsMovable()) {
 		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, MOVABLE_COLOR);
 	}
@@ -51,77 +53,19 @@ void CQTOpenGLBall::Draw(const CSphereEntity & c_entity) {
 		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, NONMOVABLE_COLOR);
 	}
 
-	// Push the state matrix
-	glPushMatrix();
-
-	// Scale to the size of the sphere
-	glScalef(c_entity.GetRadius(), c_entity.GetRadius(), c_entity.GetRadius());
-
-	// Draw a generic sphere
-	glCallList(drawListId);
-
-	// Restore the state matrix
-	glPopMatrix();
+	// Draw the shared sphere scaled to size
+	CQTOpenGLPrimitives::GetInstance().DrawSphere(c_entity.GetRadius());
 }
 
-#define PI_FLOAT ((float)(M_PI))
-
 /**
- * Draws a sphere as 2 end caps and a bunch of quad layers
+ * Sets the material shared by all balls
  */
-void CQTOpenGLBall::MakeBody() {
-	// Set the material
+void CQTOpenGLBall::MakeMaterial() {
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SHININESS, SHININESS);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, EMISSION);
 
 	glShadeModel(GL_SMOOTH);
-
-	// What resolution should we draw at?
-	int segments = 32;
-	int layers = 32;
-
-	// Top cap
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, 1);
-	for(int i = 0; i < segments; ++i)
-	{
-		double phi = PI_FLOAT/layers;
-		double theta = i * 2 * PI_FLOAT/segments;
-		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
-	}
-	glEnd();
-
-	// Middle layers
-	glBegin(GL_QUADS);
-	for(int layer = 1; layer < layers; ++layer)
-	{
-		double phi = layer * PI_FLOAT/layers;
-		double nextPhi = (layer + 1) * PI_FLOAT/layers;
-
-		for(int segment = 0; segment < segments; ++segment)
-		{
-			double theta = segment * 2 * PI_FLOAT / segments;
-			double nextTheta = (segment + 1) * 2 * PI_FLOAT / segments;
-
-			glVertex3f(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
-			glVertex3f(cos(theta) * sin(nextPhi), sin(theta) * sin(nextPhi), cos(nextPhi));
-			glVertex3f(cos(nextTheta) * sin(nextPhi), sin(nextTheta) * sin(nextPhi), cos(nextPhi));
-			glVertex3f(cos(nextTheta) * sin(phi), sin(nextTheta) * sin(phi), cos(phi));
-		}
-	}
-	glEnd();
-
-	// End cap
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, -1);
-	for(int i = 0; i < segments; ++i)
-	{
-		double phi = (layers-1) * PI_FLOAT/layers;
-		double theta = i * 2 * PI_FLOAT/segments;
-		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
-	}
-	glEnd();
 }
 
 /**
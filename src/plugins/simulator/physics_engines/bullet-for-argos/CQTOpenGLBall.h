@@ -11,7 +11,7 @@ class CQTOpenGLBall;
 #include <GL/gl.h>
 
 /**
- * Renderer for a ball
+ * Renderer for a ball, the sphere itself comes from the shared levels of detail
  */
 class CQTOpenGLBall
 {
@@ -23,7 +23,7 @@ public:
 	virtual void Draw(const CSphereEntity &c_entity);
 
 private:
-	void MakeBody();
+	void MakeMaterial();
 
 private:
 	GLuint drawListId;
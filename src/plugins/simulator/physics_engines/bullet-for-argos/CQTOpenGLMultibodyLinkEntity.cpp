@@ -3,8 +3,11 @@
 //
 
 #include "CQTOpenGLMultibodyLinkEntity.h"
+#include "CQTOpenGLPrimitives.h"
 
 #include <argos3/plugins/simulator/visualizations/qt-opengl/qtopengl_widget.h>
+#include <QOpenGLContext>
+#include <sstream>
 
 using namespace argos;
 
@@ -46,175 +49,63 @@ inline void drawBox(BoxAttributes &box)
 	glEnd();
 }
 
-#define PI_FLOAT ((float)(M_PI))
-
 /**
- * Draw a sphere as 2 end caps and a series of square strips
+ * Offset of a pointer into a mesh's storage, as used for arrays sourced from its buffer
  */
-inline void drawSphere(SphereAttributes& sphere)
+inline const GLvoid* bufferOffset(const MeshInfo* info, const void* pointer)
 {
-	float radius = sphere.radius;
-
-	glPushMatrix();
-	glEnable(GL_NORMALIZE);
-	glScalef(radius, radius, radius);
-
-	// What resolution should we draw at?
-	int segments = 32;
-	int layers = 32;
-
-	// Top cap
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, 1);
-	for(int i = 0; i < segments; ++i)
-	{
-		double phi = PI_FLOAT/layers;
-		double theta = i * 2 * PI_FLOAT/segments;
-		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
-	}
-	glEnd();
-
-	// Middle layers
-	glBegin(GL_QUADS);
-	for(int layer = 1; layer < layers; ++layer)
-	{
-		double phi = layer * PI_FLOAT/layers;
-		double nextPhi = (layer + 1) * PI_FLOAT/layers;
-
-		for(int segment = 0; segment < segments; ++segment)
-		{
-			double theta = segment * 2 * PI_FLOAT / segments;
-			double nextTheta = (segment + 1) * 2 * PI_FLOAT / segments;
-
-			glVertex3f(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
-			glVertex3f(cos(theta) * sin(nextPhi), sin(theta) * sin(nextPhi), cos(nextPhi));
-			glVertex3f(cos(nextTheta) * sin(nextPhi), sin(nextTheta) * sin(nextPhi), cos(nextPhi));
-			glVertex3f(cos(nextTheta) * sin(phi), sin(nextTheta) * sin(phi), cos(phi));
-		}
-	}
-	glEnd();
-
-	// End cap
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, -1);
-	for(int i = 0; i < segments; ++i)
-	{
-		double phi = (layers-1) * PI_FLOAT/layers;
-		double theta = i * 2 * PI_FLOAT/segments;
-		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
-	}
-	glEnd();
-
-	glDisable(GL_NORMALIZE);
-	glPopMatrix();
+	return reinterpret_cast<const GLvoid*>(static_cast<const char*>(pointer) - info->storage);
 }
 
 /**
- * Draw a cylinder as 2 end segments and a collection of rectangles
+ * Draw an arbitrary trimesh with its textures from the buffer holding its storage
  */
-inline void drawCylinder(CylinderAttributes& cylinder)
+inline void drawMesh(MeshInfo* info, GLuint buffer, QOpenGLFunctions* gl)
 {
-	float radius = cylinder.radius;
-	float length = cylinder.length;
-
-	int segments = 64;
+	// The storage holds both vertices and indices so one buffer serves as both
+	gl->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
 
-	// Draw bottom
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, 0);
-	for(int i = 0; i <= segments; ++i)
-	{
-		float angle = i * (2*PI_FLOAT/segments);
-		float x = sin(angle) * radius;
-		float y = cos(angle) * radius;
-		glVertex3f(x, y, 0);
-	}
-	glEnd();
-
-	// Draw top
-	glBegin(GL_TRIANGLE_FAN);
-	glVertex3f(0, 0, length);
-	for(int i = 0; i <= segments; ++i)
-	{
-		float angle = i * (2*PI_FLOAT/segments);
-		float x = sin(angle) * radius;
-		float y = cos(angle) * radius;
-		glVertex3f(x, y, length);
-	}
-	glEnd();
-
-	// Draw sides
-	glBegin(GL_QUADS);
-	for(int i = 0; i <= segments; ++i)
-	{
-		float angle1 = i * (2*PI_FLOAT/segments);
-		float x1 = sin(angle1) * radius;
-		float y1 = cos(angle1) * radius;
-
-		float angle2 = (i+1) * (2*PI_FLOAT/segments);
-		float x2 = sin(angle2) * radius;
-		float y2 = cos(angle2) * radius;
-
-		glVertex3f(x1, y1, 0);
-		glVertex3f(x1, y1, length);
-		glVertex3f(x2, y2, length);
-		glVertex3f(x2, y2, 0);
-	}
-	glEnd();
-}
-
-/**
- * Draw an arbitrary trimesh with the provided texture
- */
-inline void drawMesh(MeshAttributes& mesh)
-{
-	// Get the mesh info
-	MeshInfo* info = mesh.mesh;
+	// Both arrays stride over the interleaved vertices
+	glEnableClientState(GL_VERTEX_ARRAY);
 
 	// Iterate over all sub-meshes
-	for(auto key : info->keys)
+	for(auto& subMesh : info->subMeshes)
 	{
-		// Get the verts, indices and texture coordinates of this sub-mesh
-		float *verts = info->vertsMap[key];
-		int *inds = info->indicesMap[key];
-		float* uvs = info->uvsMap[key];
+		if(subMesh.numIndices == 0)
+			continue;
 
 		// Get the texture info
-		MeshTexture* texture = info->textures[key];
+		MeshTexture* texture = subMesh.texture;
 
 		// If this mesh should have a texture then its "renderId" will be non-zero
 		bool hasTexture = false;
         if(texture != nullptr)
-            hasTexture = texture->renderId > 0;
+            hasTexture = texture->renderId > 0 && subMesh.hasUvs;
 
-		// If it has one then bind it
+		// If it has one then bind it along with the texture coordinates
 		if(hasTexture)
-			glBindTexture(GL_TEXTURE_2D, texture->renderId);
-
-		// Start drawing triangles
-		glBegin(GL_TRIANGLES);
-		for (int i = 0; i < info->numIndices[key]; ++i)
 		{
-			// Get the coordinates for the current vertex
-			int idx = inds[i];
-			float x = verts[3 * idx + 0];
-			float y = verts[3 * idx + 1];
-			float z = verts[3 * idx + 2];
-
-			// Set the texture coordinates if they are provided
-			if(hasTexture)
-				glTexCoord2f(uvs[idx*2], uvs[idx*2+1]);
-
-			// And draw the vertex
-			glVertex3f(x, y, z);
+			glBindTexture(GL_TEXTURE_2D, texture->renderId);
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+			glTexCoordPointer(2, GL_FLOAT, sizeof(MeshVertex), bufferOffset(info, subMesh.vertices[0].uv));
 		}
 
-		// Finish drawing this submesh
-		glEnd();
+		// Draw the triangles
+		glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), bufferOffset(info, subMesh.vertices[0].position));
+		glDrawElements(GL_TRIANGLES, (GLsizei)subMesh.numIndices, GL_UNSIGNED_INT, bufferOffset(info, subMesh.indices));
 
 		// And unbind the texture
+		if(hasTexture)
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	// Leave client side arrays usable by anything drawn afterwards
+	gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 static const GLfloat SPECULAR[] = {0.0f, 0.0f, 0.0f, 1.0f};
@@ -224,7 +115,7 @@ static const GLfloat EMISSION[] = {0.0f, 0.0f, 0.0f, 1.0f};
 /**
  * Bind the appropriate colour for this mesh
  */
-inline void setupMaterial(GeometrySpecification& item)
+inline void setupMaterial(const GeometrySpecification& item)
 {
 	// Default reflective properties
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
@@ -242,18 +133,15 @@ inline void setupMaterial(GeometrySpecification& item)
 inline void setupMeshTextures(MeshInfo* mesh)
 {
 	// Setup textures
-	for(auto key : mesh->keys)
+	for(auto& subMesh : mesh->subMeshes)
 	{
-        if(mesh->textures.find(key) == mesh->textures.end())
-            continue;
-
 		// Key the texture info
-		MeshTexture* texture = mesh->textures[key];
-        if(texture == nullptr)
+		MeshTexture* texture = subMesh.texture;
+        if(texture == nullptr || texture->renderId != 0)
             continue;
 
-		// As long as there is image data
-		if (texture->data != nullptr)
+		// Images are only decoded now that something is drawing them
+		if (texture->Decode())
 		{
 			// Unbind a any previous texture
 			glBindTexture(GL_TEXTURE_2D, 0);
@@ -274,71 +162,97 @@ inline void setupMeshTextures(MeshInfo* mesh)
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture->width, texture->height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
 						 texture->data);
 
-			// Unbind it
+			// Unbind it, OpenGL has its own copy of the pixels now
 			glBindTexture(GL_TEXTURE_2D, 0);
+			texture->ReleaseData();
 		}
 	}
 }
 
 /**
- * Checks if a model has had its draw lists already created and returns the
- * first ID immediately if so, otherwise a draw list will be created and set up
+ * Checks if a model has had its draw lists already found and returns them
+ * immediately if so, otherwise they are looked up or created for each visual.
+ * Meshes get the buffer holding their storage instead of a list.
  */
-GLuint CQTOpenGLMultibodyLinkEntity::LazyLoadModel(CMultibodyLinkEntity & entity)
+const std::vector<GLuint>& CQTOpenGLMultibodyLinkEntity::LazyLoadModel(CMultibodyLinkEntity & entity)
 {
-	// Check if the entity already has a draw list
-	GLuint firstListId = modelDrawListIds[entity.GetId()];
+	// Check if the entity already has its draw lists
+	auto it = modelDrawListIds.find(entity.GetId());
 
-	// Return it if so
-	if(firstListId > 0)
-		return firstListId;
+	// Return them if so
+	if(it != modelDrawListIds.end())
+		return it->second;
 
 	// Otherwise get our link
 	auto link = entity.getCurrentState();
 
-	// Create our OpenGL display lists
-	auto& visualVector = link.visual;
-	firstListId = glGenLists(visualVector.size());
-
-	// For each visual element
-	for(int i = 0; i < visualVector.size(); ++i)
+	// Find a list for each box and a buffer for each mesh, spheres and cylinders are shared by every renderer
+	QOpenGLFunctions* gl = QOpenGLContext::currentContext()->functions();
+	std::vector<GLuint>& listIds = modelDrawListIds[entity.GetId()];
+	for(auto& item : link.visual)
 	{
-		// Get the item
-		auto& item = visualVector[i];
-
-		// Create a new list
-		glNewList(firstListId + i, GL_COMPILE);
-
-		// Setup our material
-		setupMaterial(item);
-
-		// Then call the appropriate draw method to issue the correct calls
 		switch (item.type)
 		{
 			case Box:
-				drawBox(item.box);
-				break;
-			case Sphere:
-				drawSphere(item.sphere);
-				break;
-			case Cylinder:
-				drawCylinder(item.cylinder);
+				listIds.push_back(LazyLoadBox(item));
 				break;
 			case Mesh:
-				setupMeshTextures(item.mesh.mesh);
-				drawMesh(item.mesh);
+				listIds.push_back(LazyLoadMesh(item.mesh.mesh, gl));
+				break;
+			default:
+				listIds.push_back(0);
 				break;
 		}
-
-		// End this list
-		glEndList();
 	}
 
-	// Save the id of the first list
-	modelDrawListIds[entity.GetId()] = firstListId;
+	return listIds;
+}
+
+/**
+ * Find the draw list for a box, creating it if no other visual has had the same size and colour
+ */
+GLuint CQTOpenGLMultibodyLinkEntity::LazyLoadBox(GeometrySpecification& item)
+{
+	// Boxes are identified by their size and colour
+	std::ostringstream key;
+	key << item.materialColour.red << " " << item.materialColour.green << " " << item.materialColour.blue << " " <<
+	item.materialColour.alpha << " " << item.box.x << " " << item.box.y << " " << item.box.z;
+
+	GLuint& listId = boxDrawListIds[key.str()];
+	if(listId > 0)
+		return listId;
 
-	// And return it
-	return firstListId;
+	// Create a new list
+	listId = glGenLists(1);
+	glNewList(listId, GL_COMPILE);
+
+	// Setup our material then issue the correct calls
+	setupMaterial(item);
+	drawBox(item.box);
+
+	// End this list
+	glEndList();
+
+	return listId;
+}
+
+/**
+ * Upload a mesh's storage into a buffer the first time any entity draws it
+ */
+GLuint CQTOpenGLMultibodyLinkEntity::LazyLoadMesh(MeshInfo* mesh, QOpenGLFunctions* gl)
+{
+	GLuint& bufferId = meshBufferIds[mesh];
+	if(bufferId > 0)
+		return bufferId;
+
+	setupMeshTextures(mesh);
+
+	gl->glGenBuffers(1, &bufferId);
+	gl->glBindBuffer(GL_ARRAY_BUFFER, bufferId);
+	gl->glBufferData(GL_ARRAY_BUFFER, mesh->storageSize, mesh->storage, GL_STATIC_DRAW);
+	gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return bufferId;
 }
 
 inline float radiansToDegrees(float radians)
@@ -358,8 +272,9 @@ void CQTOpenGLMultibodyLinkEntity::Draw(CMultibodyLinkEntity & entity)
 	// Unbind any previously bound texture
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	// Lazy load the model and get the first draw list
-	GLuint firstListId = LazyLoadModel(entity);
+	// Lazy load the model and get its draw lists and buffers
+	const std::vector<GLuint>& listIds = LazyLoadModel(entity);
+	QOpenGLFunctions* gl = QOpenGLContext::currentContext()->functions();
 
 	// Get the link
 	const Link& link = entity.getCurrentState();
@@ -385,8 +300,25 @@ void CQTOpenGLMultibodyLinkEntity::Draw(CMultibodyLinkEntity & entity)
 		glRotatef(radiansToDegrees(item.pitch), 0, 1, 0);
 		glRotatef(radiansToDegrees(item.yaw), 0, 0, 1);
 
-		// Call the correct call list
-		glCallList(firstListId + i);
+		// Call the correct call list, draw the mesh from its buffer or pick a level of detail
+		switch (item.type)
+		{
+			case Box:
+				glCallList(listIds[i]);
+				break;
+			case Sphere:
+				setupMaterial(item);
+				CQTOpenGLPrimitives::GetInstance().DrawSphere(item.sphere.radius);
+				break;
+			case Cylinder:
+				setupMaterial(item);
+				CQTOpenGLPrimitives::GetInstance().DrawCylinder(item.cylinder.radius, item.cylinder.length);
+				break;
+			case Mesh:
+				setupMaterial(item);
+				drawMesh(item.mesh.mesh, listIds[i], gl);
+				break;
+		}
 
 		// Restore the state matrix
 		glPopMatrix();
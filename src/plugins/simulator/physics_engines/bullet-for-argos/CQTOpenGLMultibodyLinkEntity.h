@@ -6,10 +6,12 @@
 #define ARGOS3_BULLET_CQTOPENGLURDFLINKENTITY_H
 
 #include <GL/gl.h>
+#include <QOpenGLFunctions>
 #include "CMultibodyLinkEntity.h"
 
 /**
- * Renderer for Multibody link entities
+ * Renderer for Multibody link entities. Geometry is shared between every entity with the same visuals
+ * so a swarm of identical robots only stores one copy of it.
  */
 class CQTOpenGLMultibodyLinkEntity
 {
@@ -21,8 +23,13 @@ public:
 	void Draw(CMultibodyLinkEntity & c_entity);
 
 private:
-	GLuint LazyLoadModel(CMultibodyLinkEntity & entity);
-	std::map<std::string, GLuint> modelDrawListIds;
+	const std::vector<GLuint>& LazyLoadModel(CMultibodyLinkEntity & entity);
+	GLuint LazyLoadBox(GeometrySpecification& item);
+	GLuint LazyLoadMesh(MeshInfo* mesh, QOpenGLFunctions* gl);
+
+	std::map<std::string, std::vector<GLuint>> modelDrawListIds;		// Draw list (or mesh buffer) of each visual
+	std::map<std::string, GLuint> boxDrawListIds;						// Shared by boxes of the same size and colour
+	std::map<const MeshInfo*, GLuint> meshBufferIds;					// Each mesh's storage, uploaded once
 };
 
 
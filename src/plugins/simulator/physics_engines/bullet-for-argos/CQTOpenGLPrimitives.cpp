@@ -0,0 +1,203 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CQTOpenGLPrimitives.h"
+
+#include <cmath>
+
+#define PI_FLOAT ((float)(M_PI))
+
+/**
+ * Number of levels of detail, level 0 being the finest
+ */
+static const int NUM_LEVELS = 4;
+
+/**
+ * Sphere resolution (segments and layers) of each level
+ */
+static const int SPHERE_SEGMENTS[NUM_LEVELS] = {32, 16, 10, 6};
+
+/**
+ * Cylinder resolution of each level
+ */
+static const int CYLINDER_SEGMENTS[NUM_LEVELS] = {64, 32, 16, 8};
+
+/**
+ * Smallest on-screen radius in pixels for each level but the coarsest
+ */
+static const float LEVEL_PIXELS[NUM_LEVELS - 1] = {48.0f, 16.0f, 4.0f};
+
+/**
+ * Draw a unit sphere as 2 end caps and a series of square strips
+ */
+static void makeSphere(int segments, int layers)
+{
+	// Top cap
+	glBegin(GL_TRIANGLE_FAN);
+	glVertex3f(0, 0, 1);
+	for(int i = 0; i <= segments; ++i)
+	{
+		double phi = PI_FLOAT/layers;
+		double theta = i * 2 * PI_FLOAT/segments;
+		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+	}
+	glEnd();
+
+	// Middle layers
+	glBegin(GL_QUADS);
+	for(int layer = 1; layer < layers - 1; ++layer)
+	{
+		double phi = layer * PI_FLOAT/layers;
+		double nextPhi = (layer + 1) * PI_FLOAT/layers;
+
+		for(int segment = 0; segment < segments; ++segment)
+		{
+			double theta = segment * 2 * PI_FLOAT / segments;
+			double nextTheta = (segment + 1) * 2 * PI_FLOAT / segments;
+
+			glVertex3f(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
+			glVertex3f(cos(theta) * sin(nextPhi), sin(theta) * sin(nextPhi), cos(nextPhi));
+			glVertex3f(cos(nextTheta) * sin(nextPhi), sin(nextTheta) * sin(nextPhi), cos(nextPhi));
+			glVertex3f(cos(nextTheta) * sin(phi), sin(nextTheta) * sin(phi), cos(phi));
+		}
+	}
+	glEnd();
+
+	// End cap
+	glBegin(GL_TRIANGLE_FAN);
+	glVertex3f(0, 0, -1);
+	for(int i = 0; i <= segments; ++i)
+	{
+		double phi = (layers-1) * PI_FLOAT/layers;
+		double theta = i * 2 * PI_FLOAT/segments;
+		glVertex3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+	}
+	glEnd();
+}
+
+/**
+ * Draw a cylinder of unit radius and length as 2 end segments and a collection of rectangles
+ */
+static void makeCylinder(int segments)
+{
+	// Draw bottom and top
+	for(int end = 0; end < 2; ++end)
+	{
+		float z = end;
+		glBegin(GL_TRIANGLE_FAN);
+		glVertex3f(0, 0, z);
+		for(int i = 0; i <= segments; ++i)
+		{
+			float angle = i * (2*PI_FLOAT/segments);
+			glVertex3f(sin(angle), cos(angle), z);
+		}
+		glEnd();
+	}
+
+	// Draw sides
+	glBegin(GL_QUAD_STRIP);
+	for(int i = 0; i <= segments; ++i)
+	{
+		float angle = i * (2*PI_FLOAT/segments);
+		glVertex3f(sin(angle), cos(angle), 0);
+		glVertex3f(sin(angle), cos(angle), 1);
+	}
+	glEnd();
+}
+
+/**
+ * Lists are built the first time anything is drawn, once there is a context to build them in
+ */
+CQTOpenGLPrimitives& CQTOpenGLPrimitives::GetInstance()
+{
+	static CQTOpenGLPrimitives instance;
+	return instance;
+}
+
+/**
+ * Tessellate every level of each primitive once
+ */
+CQTOpenGLPrimitives::CQTOpenGLPrimitives()
+{
+	sphereListIds = glGenLists(NUM_LEVELS);
+	cylinderListIds = glGenLists(NUM_LEVELS);
+
+	for(int level = 0; level < NUM_LEVELS; ++level)
+	{
+		glNewList(sphereListIds + level, GL_COMPILE);
+		makeSphere(SPHERE_SEGMENTS[level], SPHERE_SEGMENTS[level]);
+		glEndList();
+
+		glNewList(cylinderListIds + level, GL_COMPILE);
+		makeCylinder(CYLINDER_SEGMENTS[level]);
+		glEndList();
+	}
+}
+
+/**
+ * Destructor releases the call lists
+ */
+CQTOpenGLPrimitives::~CQTOpenGLPrimitives()
+{
+	glDeleteLists(sphereListIds, NUM_LEVELS);
+	glDeleteLists(cylinderListIds, NUM_LEVELS);
+}
+
+/**
+ * Estimate how many pixels something of the given size at the current origin covers, using the
+ * distance to the camera and the projection's vertical scale
+ */
+int CQTOpenGLPrimitives::SelectLevel(float size) const
+{
+	GLfloat modelView[16], projection[16];
+	GLint viewport[4];
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	// The origin's position relative to the camera is the modelview's translation
+	float distance = std::sqrt(modelView[12] * modelView[12] + modelView[13] * modelView[13] +
+							   modelView[14] * modelView[14]);
+	if(distance <= size)
+		return 0;
+
+	float pixels = size * projection[5] * 0.5f * viewport[3] / distance;
+	for(int level = 0; level < NUM_LEVELS - 1; ++level)
+	{
+		if(pixels >= LEVEL_PIXELS[level])
+			return level;
+	}
+
+	return NUM_LEVELS - 1;
+}
+
+/**
+ * Scale the unit sphere of the right level to size
+ */
+void CQTOpenGLPrimitives::DrawSphere(float radius)
+{
+	int level = SelectLevel(radius);
+
+	glPushMatrix();
+	glEnable(GL_NORMALIZE);
+	glScalef(radius, radius, radius);
+	glCallList(sphereListIds + level);
+	glDisable(GL_NORMALIZE);
+	glPopMatrix();
+}
+
+/**
+ * Scale the unit cylinder of the right level to size, its detail depends on the larger dimension
+ */
+void CQTOpenGLPrimitives::DrawCylinder(float radius, float length)
+{
+	int level = SelectLevel(radius > length ? radius : length);
+
+	glPushMatrix();
+	glEnable(GL_NORMALIZE);
+	glScalef(radius, radius, length);
+	glCallList(cylinderListIds + level);
+	glDisable(GL_NORMALIZE);
+	glPopMatrix();
+}
@@ -0,0 +1,43 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CQTOPENGLPRIMITIVES_H
+#define ARGOS3_BULLET_CQTOPENGLPRIMITIVES_H
+
+#include <GL/gl.h>
+
+/**
+ * Spheres and cylinders pre-tessellated at several levels of detail, shared by every renderer.
+ * The level is picked from how large the primitive appears on screen so distant ones cost
+ * a fraction of close ones. The current material is used.
+ */
+class CQTOpenGLPrimitives
+{
+public:
+	static CQTOpenGLPrimitives& GetInstance();
+
+	/**
+	 * Draw a sphere centred on the origin
+	 */
+	void DrawSphere(float radius);
+
+	/**
+	 * Draw a cylinder along Z with its base on the origin
+	 */
+	void DrawCylinder(float radius, float length);
+
+	CQTOpenGLPrimitives(const CQTOpenGLPrimitives&) = delete;
+	CQTOpenGLPrimitives& operator=(const CQTOpenGLPrimitives&) = delete;
+
+private:
+	CQTOpenGLPrimitives();
+	~CQTOpenGLPrimitives();
+
+	int SelectLevel(float size) const;
+
+	GLuint sphereListIds;			// First of one unit sphere list per level
+	GLuint cylinderListIds;			// First of one unit cylinder list per level
+};
+
+#endif //ARGOS3_BULLET_CQTOPENGLPRIMITIVES_H
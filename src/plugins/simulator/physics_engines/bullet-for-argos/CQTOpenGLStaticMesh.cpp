@@ -0,0 +1,107 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CQTOpenGLStaticMesh.h"
+#include "CStaticMeshEntity.h"
+#include <argos3/plugins/simulator/visualizations/qt-opengl/qtopengl_widget.h>
+
+using namespace argos;
+
+/**
+ * Static meshes are drawn in the same grey as other non-movable primitives
+ */
+static const GLfloat COLOR[]     = { 0.7f, 0.7f, 0.7f, 1.0f };
+static const GLfloat SPECULAR[]  = { 0.0f, 0.0f, 0.0f, 1.0f };
+static const GLfloat SHININESS[] = { 0.0f                   };
+static const GLfloat EMISSION[]  = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+/**
+ * Destructor releases every call list
+ */
+CQTOpenGLStaticMesh::~CQTOpenGLStaticMesh()
+{
+	for(auto& list : drawListIds)
+		glDeleteLists(list.second, 1);
+}
+
+/**
+ * Call the mesh's list scaled to the entity's size
+ */
+void CQTOpenGLStaticMesh::Draw(const CStaticMeshEntity &c_entity)
+{
+	GLuint drawListId = GetDrawList(c_entity.GetMesh());
+
+	// Push the state matrix
+	glPushMatrix();
+
+	// Scale to the size of the mesh
+	glScalef(c_entity.GetScale().GetX(), c_entity.GetScale().GetY(), c_entity.GetScale().GetZ());
+
+	// Draw the mesh
+	glCallList(drawListId);
+
+	// Restore the state matrix
+	glPopMatrix();
+}
+
+/**
+ * Compile the triangles of every sub-mesh into a call list the first time a mesh is drawn
+ */
+GLuint CQTOpenGLStaticMesh::GetDrawList(const MeshInfo& mesh)
+{
+	auto it = drawListIds.find(&mesh);
+	if(it != drawListIds.end())
+		return it->second;
+
+	GLuint drawListId = glGenLists(1);
+	glNewList(drawListId, GL_COMPILE);
+
+	// Set the material
+	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, COLOR);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_SHININESS, SHININESS);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, EMISSION);
+
+	glBegin(GL_TRIANGLES);
+	for(auto& subMesh : mesh.subMeshes)
+	{
+		for(unsigned long i = 0; i < subMesh.numIndices; ++i)
+			glVertex3fv(subMesh.vertices[subMesh.indices[i]].position);
+	}
+	glEnd();
+
+	glEndList();
+
+	drawListIds[&mesh] = drawListId;
+	return drawListId;
+}
+
+/**
+ * Operation to draw the provided static mesh
+ */
+class CQTOpenGLOperationDrawStaticMeshNormal : public CQTOpenGLOperationDrawNormal {
+public:
+	void ApplyTo(CQTOpenGLWidget& c_visualization,
+				 CStaticMeshEntity & c_entity) {
+		static CQTOpenGLStaticMesh m_cModel;
+		c_visualization.DrawEntity(c_entity.GetEmbodiedEntity());
+		m_cModel.Draw(c_entity);
+	}
+};
+
+/**
+ * Operation to draw the selected static mesh with a bounding box
+ */
+class CQTOpenGLOperationDrawStaticMeshSelected : public CQTOpenGLOperationDrawSelected {
+public:
+	void ApplyTo(CQTOpenGLWidget& c_visualization,
+				 CStaticMeshEntity & c_entity) {
+		c_visualization.DrawBoundingBox(c_entity.GetEmbodiedEntity());
+	}
+};
+
+
+REGISTER_QTOPENGL_ENTITY_OPERATION(CQTOpenGLOperationDrawNormal, CQTOpenGLOperationDrawStaticMeshNormal, CStaticMeshEntity);
+
+REGISTER_QTOPENGL_ENTITY_OPERATION(CQTOpenGLOperationDrawSelected, CQTOpenGLOperationDrawStaticMeshSelected, CStaticMeshEntity);
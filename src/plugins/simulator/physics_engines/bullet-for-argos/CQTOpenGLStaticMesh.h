@@ -0,0 +1,33 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CQTOPENGLSTATICMESH_H
+#define ARGOS3_BULLET_CQTOPENGLSTATICMESH_H
+
+class CStaticMeshEntity;
+struct MeshInfo;
+
+#include <GL/gl.h>
+#include <map>
+
+/**
+ * Renderer for static meshes, each mesh is compiled into a call list once
+ */
+class CQTOpenGLStaticMesh
+{
+public:
+	CQTOpenGLStaticMesh() {}
+
+	virtual ~CQTOpenGLStaticMesh();
+
+	virtual void Draw(const CStaticMeshEntity &c_entity);
+
+private:
+	GLuint GetDrawList(const MeshInfo& mesh);
+
+private:
+	std::map<const MeshInfo*, GLuint> drawListIds;
+};
+
+#endif //ARGOS3_BULLET_CQTOPENGLSTATICMESH_H
@@ -0,0 +1,335 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CShapeCache.h"
+#include "ConvexHullReduction.h"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Build a key from a shape type and any number of values, exact enough to tell any two floats apart
+ */
+template<typename... T>
+static std::string makeKey(const char* type, T... values)
+{
+	std::ostringstream ss;
+	ss << type << std::setprecision(9);
+	for(double value : {(double)values...})
+		ss << ' ' << value;
+	return ss.str();
+}
+
+/**
+ * Hand out the process wide cache, making a new one if every engine using the last has gone
+ */
+std::shared_ptr<CShapeCache> CShapeCache::GetShared()
+{
+	static std::mutex sharedMutex;
+	static std::weak_ptr<CShapeCache> shared;
+
+	std::lock_guard<std::mutex> lock(sharedMutex);
+	std::shared_ptr<CShapeCache> cache = shared.lock();
+	if(!cache)
+	{
+		cache = std::make_shared<CShapeCache>();
+		shared = cache;
+	}
+
+	return cache;
+}
+
+/**
+ * Free everything still cached, bodies using these shapes must already have been deleted
+ */
+CShapeCache::~CShapeCache()
+{
+	for(auto& entry : entries)
+		DeleteEntry(entry.second);
+
+	for(auto& mesh : triangleData)
+		for(auto data : mesh.second)
+			delete data;
+
+	for(auto& mesh : staticMeshes)
+		delete mesh.second;
+}
+
+/**
+ * Shared box with the given half extents
+ */
+btBoxShape* CShapeCache::GetBox(const btVector3& halfExtents)
+{
+	std::string key = makeKey("box", halfExtents.x(), halfExtents.y(), halfExtents.z());
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btBoxShape*>(shape);
+
+	return static_cast<btBoxShape*>(Insert(key, new btBoxShape{halfExtents}));
+}
+
+/**
+ * Shared sphere with the given radius
+ */
+btSphereShape* CShapeCache::GetSphere(btScalar radius)
+{
+	std::string key = makeKey("sphere", radius);
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btSphereShape*>(shape);
+
+	return static_cast<btSphereShape*>(Insert(key, new btSphereShape{radius}));
+}
+
+/**
+ * Shared Z aligned cylinder with the given half extents
+ */
+btCylinderShapeZ* CShapeCache::GetCylinderZ(const btVector3& halfExtents)
+{
+	std::string key = makeKey("cylinderZ", halfExtents.x(), halfExtents.y(), halfExtents.z());
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btCylinderShapeZ*>(shape);
+
+	return static_cast<btCylinderShapeZ*>(Insert(key, new btCylinderShapeZ{halfExtents}));
+}
+
+/**
+ * Shared compound of convex sub-meshes. Each scale needs its own shapes but they all read the same triangle data.
+ */
+btCompoundShape* CShapeCache::GetMesh(const MeshInfo& mesh, const btVector3& scale, btScalar margin)
+{
+	std::ostringstream meshId;
+	meshId << "mesh " << &mesh;
+	std::string key = makeKey(meshId.str().c_str(), scale.x(), scale.y(), scale.z(), margin);
+
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btCompoundShape*>(shape);
+
+	btCompoundShape* meshShape = new btCompoundShape;
+	std::vector<btCollisionShape*> subShapes;
+	for(auto data : GetTriangleData(mesh))
+	{
+		btConvexTriangleMeshShape* subShape = new btConvexTriangleMeshShape{data};
+		subShape->setMargin(margin);
+		meshShape->addChildShape(btTransform::getIdentity(), subShape);
+		subShapes.push_back(subShape);
+	}
+
+	// Compound scaling is passed down to the sub-shapes, which is why they can't be shared between scales
+	meshShape->setLocalScaling(scale);
+	meshShape->setMargin(margin);
+
+	Insert(key, meshShape);
+	entries[key].ownedShapes = subShapes;
+	return meshShape;
+}
+
+/**
+ * Shared compound of reduced hulls, one per sub-mesh. Reduction results are cached on disk as well.
+ */
+btCompoundShape* CShapeCache::GetMeshHulls(const MeshInfo& mesh, const btVector3& scale, btScalar margin, int maxVertices)
+{
+	std::ostringstream meshId;
+	meshId << "meshHulls " << &mesh;
+	std::string key = makeKey(meshId.str().c_str(), scale.x(), scale.y(), scale.z(), margin, maxVertices);
+
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btCompoundShape*>(shape);
+
+	// Hulls are built from scaled points so the shapes themselves are unscaled
+	btAlignedObjectArray<THullPoints> hulls;
+	getMeshHulls(mesh, scale, maxVertices, hulls);
+	return InsertHulls(key, hulls, margin);
+}
+
+/**
+ * Shared BVH mesh. The triangles and BVH outlive the shape so a later request never rebuilds or remaps them.
+ */
+btBvhTriangleMeshShape* CShapeCache::GetStaticMesh(const MeshInfo& mesh, const btVector3& scale)
+{
+	std::ostringstream meshId;
+	meshId << "staticMesh " << &mesh;
+	std::string key = makeKey(meshId.str().c_str(), scale.x(), scale.y(), scale.z());
+
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btBvhTriangleMeshShape*>(shape);
+
+	CStaticMeshBvh*& bvh = staticMeshes[key];
+	if(!bvh)
+		bvh = new CStaticMeshBvh{mesh, scale};
+
+	// Passing the mesh's own scaling stops the shape resetting it to 1
+	btBvhTriangleMeshShape* meshShape = new btBvhTriangleMeshShape{bvh->GetTriangles(), true, false};
+	meshShape->setOptimizedBvh(bvh->GetBvh(), bvh->GetTriangles()->getScaling());
+
+	return static_cast<btBvhTriangleMeshShape*>(Insert(key, meshShape));
+}
+
+/**
+ * Shared compound of the hulls of a decomposition, one per decomposition since their points are already scaled
+ */
+btCompoundShape* CShapeCache::GetDecomposition(const ConvexDecomposition& decomposition, btScalar margin)
+{
+	std::ostringstream decompositionId;
+	decompositionId << "decomposition " << &decomposition;
+	std::string key = makeKey(decompositionId.str().c_str(), margin);
+
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if(btCollisionShape* shape = Find(key))
+		return static_cast<btCompoundShape*>(shape);
+
+	return InsertHulls(key, decomposition.hulls, margin);
+}
+
+/**
+ * Build a compound with a hull shape per non-empty point set and cache it, the hulls belong to the compound
+ */
+btCompoundShape* CShapeCache::InsertHulls(const std::string& key, const btAlignedObjectArray<THullPoints>& hulls,
+										  btScalar margin)
+{
+	btCompoundShape* compound = new btCompoundShape;
+	std::vector<btCollisionShape*> subShapes;
+	for(int i = 0; i < hulls.size(); ++i)
+	{
+		if(hulls[i].size() == 0)
+			continue;
+
+		btConvexHullShape* subShape = new btConvexHullShape{&hulls[i][0].x(), hulls[i].size(), sizeof(btVector3)};
+		subShape->setMargin(margin);
+		compound->addChildShape(btTransform::getIdentity(), subShape);
+		subShapes.push_back(subShape);
+	}
+	compound->setMargin(margin);
+
+	Insert(key, compound);
+	entries[key].ownedShapes = subShapes;
+	return compound;
+}
+
+/**
+ * Wrap every sub-mesh of a mesh for bullet, once per mesh
+ */
+std::vector<btTriangleIndexVertexArray*>& CShapeCache::GetTriangleData(const MeshInfo& mesh)
+{
+	auto it = triangleData.find(&mesh);
+	if(it != triangleData.end())
+		return it->second;
+
+	std::vector<btTriangleIndexVertexArray*>& data = triangleData[&mesh];
+	for(auto& subMesh : mesh.subMeshes)
+	{
+		// Bullet strides over the interleaved vertices so it reads the mesh's storage directly
+		data.push_back(new btTriangleIndexVertexArray{(int)subMesh.numIndices / 3, subMesh.indices, 3 * sizeof(int),
+													  (int)subMesh.numVertices, reinterpret_cast<btScalar*>(subMesh.vertices),
+													  sizeof(MeshVertex)});
+	}
+
+	return data;
+}
+
+/**
+ * Find a shape by key and take a reference to it
+ */
+btCollisionShape* CShapeCache::Find(const std::string& key)
+{
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	auto it = entries.find(key);
+	if(it == entries.end())
+		return nullptr;
+
+	++it->second.references;
+	return it->second.shape;
+}
+
+/**
+ * Take ownership of a new shape with a single reference
+ */
+btCollisionShape* CShapeCache::Insert(const std::string& key, btCollisionShape* shape,
+									  const std::vector<btCollisionShape*>& children)
+{
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	// Somebody beat us to it, use theirs
+	if(btCollisionShape* existing = Find(key))
+	{
+		for(auto child : children)
+			Release(child);
+		delete shape;
+		return existing;
+	}
+
+	entries[key] = SEntry{shape, 1, children};
+	keys[shape] = key;
+	return shape;
+}
+
+/**
+ * Reverse lookup of a shape's key
+ */
+std::string CShapeCache::GetKey(btCollisionShape* shape)
+{
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	auto it = keys.find(shape);
+	return it == keys.end() ? std::string{} : it->second;
+}
+
+/**
+ * Take another reference to a cached shape
+ */
+void CShapeCache::Retain(btCollisionShape* shape)
+{
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	auto it = keys.find(shape);
+	if(it != keys.end())
+		++entries[it->second].references;
+}
+
+/**
+ * Drop a reference, deleting the shape and releasing its children once nobody uses it
+ */
+void CShapeCache::Release(btCollisionShape* shape)
+{
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	auto it = keys.find(shape);
+	if(it == keys.end())
+		return;
+
+	auto entry = entries.find(it->second);
+	if(--entry->second.references > 0)
+		return;
+
+	std::vector<btCollisionShape*> children = entry->second.children;
+
+	DeleteEntry(entry->second);
+	entries.erase(entry);
+	keys.erase(it);
+
+	for(auto child : children)
+		Release(child);
+}
+
+/**
+ * Delete a shape along with any sub-shapes only it uses
+ */
+void CShapeCache::DeleteEntry(SEntry& entry)
+{
+	delete entry.shape;
+	for(auto owned : entry.ownedShapes)
+		delete owned;
+}
+
+/**
+ * Key fragment for a transform
+ */
+std::string CShapeCache::TransformKey(const btTransform& transform)
+{
+	const btVector3& origin = transform.getOrigin();
+	btQuaternion rotation = transform.getRotation();
+	return makeKey("at", origin.x(), origin.y(), origin.z(), rotation.x(), rotation.y(), rotation.z(), rotation.w());
+}
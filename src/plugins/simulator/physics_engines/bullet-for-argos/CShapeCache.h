@@ -0,0 +1,100 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CSHAPECACHE_H
+#define ARGOS3_BULLET_CSHAPECACHE_H
+
+#include "./bullet/src/btBulletCollisionCommon.h"
+#include "MeshInfo.h"
+#include "ConvexDecomposition.h"
+#include "StaticMeshBvh.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Hands out shared, reference counted collision shapes keyed on their geometry.
+ *
+ * Every entity asking for a box of the same size (or the same mesh at the same scale)
+ * gets the same shape, so a swarm of identical robots holds one copy of each shape.
+ * Shapes built from other cached shapes (compounds) keep a reference to their children
+ * until they are freed themselves. Triangle data is shared between every scale of a mesh.
+ * Bullet only reads shapes while stepping, so engines stepped on different threads can
+ * share one cache and pay for each shape and BVH once.
+ */
+class CShapeCache
+{
+public:
+	CShapeCache() = default;
+	~CShapeCache();
+
+	CShapeCache(const CShapeCache&) = delete;
+	CShapeCache& operator=(const CShapeCache&) = delete;
+
+	// The cache every engine in the process shares, created with the first engine and freed with the last
+	static std::shared_ptr<CShapeCache> GetShared();
+
+	// Primitive shapes, sizes are in bullet units
+	btBoxShape* GetBox(const btVector3& halfExtents);
+	btSphereShape* GetSphere(btScalar radius);
+	btCylinderShapeZ* GetCylinderZ(const btVector3& halfExtents);
+
+	// Every sub-mesh of a mesh as a convex shape, scaled and with the given margin
+	btCompoundShape* GetMesh(const MeshInfo& mesh, const btVector3& scale, btScalar margin);
+
+	// As above but each sub-mesh reduced to a hull of at most maxVertices points
+	btCompoundShape* GetMeshHulls(const MeshInfo& mesh, const btVector3& scale, btScalar margin, int maxVertices);
+
+	// Static triangle mesh with the scale baked into its BVH, which is read from the asset cache if possible
+	btBvhTriangleMeshShape* GetStaticMesh(const MeshInfo& mesh, const btVector3& scale);
+
+	// Every part of a convex decomposition as a hull, the points are already scaled
+	btCompoundShape* GetDecomposition(const ConvexDecomposition& decomposition, btScalar margin);
+
+	// Look up an arbitrary shape by key, taking a reference if it exists
+	btCollisionShape* Find(const std::string& key);
+
+	// Add a new shape holding references to the given children. If another shape was added under
+	// the same key first, the new one is discarded and the existing shape returned.
+	btCollisionShape* Insert(const std::string& key, btCollisionShape* shape,
+							 const std::vector<btCollisionShape*>& children = std::vector<btCollisionShape*>{});
+
+	// Key a cached shape was stored under, empty if it isn't cached
+	std::string GetKey(btCollisionShape* shape);
+
+	// Take or drop a reference, the shape is deleted once nothing refers to it
+	void Retain(btCollisionShape* shape);
+	void Release(btCollisionShape* shape);
+
+	// Unique part of a key for a transform, used to build keys for compounds
+	static std::string TransformKey(const btTransform& transform);
+
+private:
+	/**
+	 * A cached shape, its reference count and the cached shapes it is built from
+	 */
+	struct SEntry
+	{
+		btCollisionShape* shape;
+		int references;
+		std::vector<btCollisionShape*> children;
+		std::vector<btCollisionShape*> ownedShapes;		// Uncached sub-shapes deleted along with this one
+	};
+
+	void DeleteEntry(SEntry& entry);
+
+	std::vector<btTriangleIndexVertexArray*>& GetTriangleData(const MeshInfo& mesh);
+	btCompoundShape* InsertHulls(const std::string& key, const btAlignedObjectArray<THullPoints>& hulls, btScalar margin);
+
+	std::recursive_mutex mutex;
+	std::map<std::string, SEntry> entries;
+	std::map<btCollisionShape*, std::string> keys;											// Reverse lookup for Release
+	std::map<const MeshInfo*, std::vector<btTriangleIndexVertexArray*>> triangleData;		// One per sub-mesh
+	std::map<std::string, CStaticMeshBvh*> staticMeshes;									// Triangles and BVH per mesh and scale
+};
+
+#endif //ARGOS3_BULLET_CSHAPECACHE_H
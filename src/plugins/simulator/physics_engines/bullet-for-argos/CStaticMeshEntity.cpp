@@ -0,0 +1,68 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CStaticMeshEntity.h"
+#include "MultibodyEntityDatabase.h"
+
+CStaticMeshEntity::CStaticMeshEntity()
+		: CComposableEntity(NULL), m_pcEmbodiedEntity(nullptr), m_pcMesh(nullptr), m_cScale(1, 1, 1)
+{
+}
+
+/**
+ * Load the mesh and its placement from the XML tag
+ */
+void CStaticMeshEntity::Init(TConfigurationNode &t_tree)
+{
+	try
+	{
+		// Init parent
+		CComposableEntity::Init(t_tree);
+
+		// Parse XML to get the mesh (required), meshes are shared with multibody entities
+		std::string meshFile;
+		GetNodeAttribute(t_tree, "mesh_file", meshFile);
+		m_pcMesh = MultibodyDefinition::LoadMesh(meshFile);
+		if(!m_pcMesh)
+			THROW_ARGOSEXCEPTION("Unsupported mesh file \"" << meshFile << "\"");
+
+		// Parse XML to get the scale (optional, defaults to 1,1,1)
+		GetNodeAttributeOrDefault(t_tree, "scale", m_cScale, CVector3(1, 1, 1));
+
+		// Create embodied entity using parsed data, the mesh can never move
+		m_pcEmbodiedEntity = new CEmbodiedEntity(this);
+
+		m_pcEmbodiedEntity->Init(GetNode(t_tree, "body"));
+		m_pcEmbodiedEntity->SetMovable(false);
+		AddComponent(*m_pcEmbodiedEntity);
+
+		UpdateComponents();
+	}
+	catch (CARGoSException &ex)
+	{
+		THROW_ARGOSEXCEPTION_NESTED("Failed to initialize the static mesh entity.", ex);
+	}
+}
+
+/****************************************/
+/****************************************/
+
+void CStaticMeshEntity::Reset()
+{
+	/* Reset all components */
+	m_pcEmbodiedEntity->Reset();
+
+	/* Update components */
+	UpdateComponents();
+}
+
+
+REGISTER_ENTITY(CStaticMeshEntity,"static_mesh","Richard Redpath","1.0","A static triangle mesh",
+				"An immovable triangle mesh for arenas, mazes and terrain. Its BVH is cached next to the mesh file so "
+				"only the first experiment using it pays for building one.\n\n"
+				"<static_mesh id=\"arena\" mesh_file=\"maze.obj\" scale=\"1,1,1\">\n"
+				"  <body position=\"0,0,0\" orientation=\"0,0,0\" />\n"
+				"</static_mesh>","Usable");
+
+REGISTER_STANDARD_SPACE_OPERATIONS_ON_COMPOSABLE(CStaticMeshEntity);
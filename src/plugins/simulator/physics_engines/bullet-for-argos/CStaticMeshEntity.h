@@ -0,0 +1,58 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CSTATICMESHENTITY_H
+#define ARGOS3_BULLET_CSTATICMESHENTITY_H
+
+#include <argos3/core/simulator/entity/composable_entity.h>
+#include <argos3/core/simulator/entity/embodied_entity.h>
+
+#include "MeshInfo.h"
+
+using namespace argos;
+
+/*
+ * A large immovable triangle mesh such as an arena, maze or terrain scan
+ */
+class CStaticMeshEntity : public CComposableEntity
+{
+public:
+	ENABLE_VTABLE();
+
+	CStaticMeshEntity();
+
+	inline CEmbodiedEntity& GetEmbodiedEntity() {
+		return *m_pcEmbodiedEntity;
+	}
+
+	inline const CEmbodiedEntity& GetEmbodiedEntity() const {
+		return *m_pcEmbodiedEntity;
+	}
+
+	virtual void Init(TConfigurationNode &t_tree);
+
+	virtual void Reset();
+
+	inline const MeshInfo& GetMesh() const
+	{
+		return *m_pcMesh;
+	}
+
+	inline const CVector3& GetScale() const
+	{
+		return m_cScale;
+	}
+
+	virtual std::string GetTypeDescription() const
+	{
+		return "static_mesh";
+	}
+
+private:
+	CEmbodiedEntity *m_pcEmbodiedEntity;
+	MeshInfo* m_pcMesh;						// Shared with every other user of the same file
+	CVector3 m_cScale;
+};
+
+#endif //ARGOS3_BULLET_CSTATICMESHENTITY_H
@@ -0,0 +1,154 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CStepProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Nearest rank percentile of sorted times
+ */
+static float percentile(const std::vector<float>& sorted, double fraction)
+{
+	size_t rank = (size_t)std::ceil(fraction*sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+/**
+ * Forget user pointers left in the tree, it outlives us
+ */
+static void clearUserPointers(CProfileIterator& iterator)
+{
+	int children = 0;
+	for(iterator.First(); !iterator.Is_Done(); iterator.Next(), ++children)
+		iterator.Set_Current_UserPointer(nullptr);
+
+	for(int i = 0; i < children; ++i)
+	{
+		iterator.Enter_Child(i);
+		clearUserPointers(iterator);
+		iterator.Enter_Parent();
+	}
+}
+
+CStepProfiler::CStepProfiler(const std::string& file, int interval) : file(file), interval(interval)
+{
+}
+
+/**
+ * Whatever was recorded since the last interval is written when the experiment ends
+ */
+CStepProfiler::~CStepProfiler()
+{
+	Write();
+
+	CProfileIterator* iterator = CProfileManager::Get_Iterator();
+	clearUserPointers(*iterator);
+	CProfileManager::Release_Iterator(iterator);
+}
+
+/**
+ * Clear the tree's times so everything it holds at the end belongs to this tick
+ */
+void CStepProfiler::BeginTick()
+{
+	CProfileManager::Set_Profiling_Thread(true);
+	CProfileManager::Reset();
+}
+
+/**
+ * Every phase known so far gets a time for this tick, zero if it didn't run
+ */
+void CStepProfiler::EndTick(uint32_t simulationClock)
+{
+	CProfileManager::Set_Profiling_Thread(false);
+
+	CProfileIterator* iterator = CProfileManager::Get_Iterator();
+	Collect(*iterator, "");
+	CProfileManager::Release_Iterator(iterator);
+
+	++windowTicks;
+	lastClock = simulationClock;
+
+	if(interval > 0 && windowTicks >= interval)
+		Write();
+}
+
+/**
+ * Add the times of the iterator's children and then of everything below them
+ */
+void CStepProfiler::Collect(CProfileIterator& iterator, const std::string& parentPath)
+{
+	std::vector<SPhase*> children;
+	for(iterator.First(); !iterator.Is_Done(); iterator.Next())
+	{
+		SPhase* phase = static_cast<SPhase*>(iterator.Get_Current_UserPointer());
+		if(!phase)
+		{
+			// Phases first seen part way through the window didn't run before it
+			phases.push_back(SPhase{parentPath + iterator.Get_Current_Name(), std::vector<float>(windowTicks, 0.0f), 0});
+			phase = &phases.back();
+			iterator.Set_Current_UserPointer(phase);
+		}
+
+		phase->times.push_back(iterator.Get_Current_Total_Time());
+		phase->calls += iterator.Get_Current_Total_Calls();
+		children.push_back(phase);
+	}
+
+	for(int i = 0; i < (int)children.size(); ++i)
+	{
+		iterator.Enter_Child(i);
+		Collect(iterator, children[i]->path + "/");
+		iterator.Enter_Parent();
+	}
+}
+
+/**
+ * One row per phase for the window ending at the latest tick, the header is written when the file is started
+ */
+bool CStepProfiler::Write()
+{
+	if(windowTicks == 0)
+		return true;
+
+	std::ofstream out{file, started ? std::ios::app : std::ios::trunc};
+	if(!out)
+	{
+		std::cerr << "Unable to write bullet profile to \"" << file << "\"" << std::endl;
+		return false;
+	}
+
+	if(!started)
+		out << "tick,phase,ticks,calls,calls_per_tick,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,total_ms" << std::endl;
+	started = true;
+
+	std::vector<float> sorted;
+	for(auto& phase : phases)
+	{
+		if(phase.times.empty())
+			continue;
+
+		sorted = phase.times;
+		std::sort(sorted.begin(), sorted.end());
+
+		double total = 0;
+		for(float time : sorted)
+			total += time;
+
+		out << lastClock << "," << phase.path << "," << windowTicks << "," << phase.calls << ","
+			<< (double)phase.calls/windowTicks << "," << total/windowTicks << "," << percentile(sorted, 0.5) << ","
+			<< percentile(sorted, 0.9) << "," << percentile(sorted, 0.99) << "," << sorted.back() << ","
+			<< total << std::endl;
+
+		phase.times.clear();
+		phase.calls = 0;
+	}
+
+	windowTicks = 0;
+	return (bool)out;
+}
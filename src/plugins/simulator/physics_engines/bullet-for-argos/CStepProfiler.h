@@ -0,0 +1,61 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CSTEPPROFILER_H
+#define ARGOS3_BULLET_CSTEPPROFILER_H
+
+#include "./bullet/src/LinearMath/btQuickprof.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Records how long every phase of a tick takes, using bullet's own profile tree. Bullet's phases (broadphase,
+ * narrowphase, islands, solver, integration...) appear under stepSimulation alongside the engine's own, each is
+ * named by its path through the tree.
+ *
+ * The tree is shared by the whole process so only one engine can be profiled, and only the thread stepping it
+ * records samples. Per tick times are kept for each phase so percentiles can be given, they are written to a CSV
+ * file and forgotten every interval ticks, or once at the end if the interval is 0.
+ */
+class CStepProfiler
+{
+public:
+	CStepProfiler(const std::string& file, int interval);
+	~CStepProfiler();
+
+	// Start recording a tick on the calling thread
+	void BeginTick();
+
+	// Stop recording and add the tick's times, writing the window out if the interval has been reached
+	void EndTick(uint32_t simulationClock);
+
+	// Append the statistics of every tick since the last write, false if the file couldn't be written
+	bool Write();
+
+private:
+	/**
+	 * A node of the profile tree and the time it took on each tick of the current window
+	 */
+	struct SPhase
+	{
+		std::string path;
+		std::vector<float> times;		// Milliseconds per tick
+		uint64_t calls;
+	};
+
+	void Collect(CProfileIterator& iterator, const std::string& parentPath);
+
+	std::string file;
+	int interval;
+
+	std::deque<SPhase> phases;			// Addresses are kept in the nodes' user pointers so must not move
+	int windowTicks{0};					// Ticks since the last write
+	uint32_t lastClock{0};				// Simulation clock of the latest tick
+	bool started{false};				// Has the file been started (and its header written)?
+};
+
+#endif //ARGOS3_BULLET_CSTEPPROFILER_H
@@ -0,0 +1,254 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "CWorldSnapshot.h"
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
+#include "BulletDynamics/Featherstone/btMultiBody.h"
+#include "BulletDynamics/Featherstone/btMultiBodyDynamicsWorld.h"
+#include "BulletDynamics/Featherstone/btMultiBodyLinkCollider.h"
+
+#include <algorithm>
+
+/**
+ * Removes every pair it is shown, which destroys their algorithms and manifolds
+ */
+struct SRemoveAllPairsCallback : public btOverlapCallback
+{
+	virtual bool processOverlap(btBroadphasePair& pair) override
+	{
+		return true;
+	}
+};
+
+/**
+ * Recreate every proxy in the order the objects were added, from where they are now. Pairs, their order and the
+ * broadphase trees then only depend on where things are, not on how they got there.
+ */
+void CWorldSnapshot::RebuildBroadphase(btDynamicsWorld& world, btDbvtBroadphase& broadphase)
+{
+	btDispatcher* dispatcher = world.getDispatcher();
+
+	// Dropping every pair in one pass leaves nothing for destroying each proxy to search through
+	SRemoveAllPairsCallback removeAll;
+	world.getPairCache()->processAllOverlappingPairs(&removeAll, dispatcher);
+
+	btCollisionObjectArray& objects = world.getCollisionObjectArray();
+	std::vector<std::pair<short, short>> filters((size_t)objects.size());
+	for(int i = 0; i < objects.size(); ++i)
+	{
+		btBroadphaseProxy* proxy = objects[i]->getBroadphaseHandle();
+		filters[i] = std::make_pair(proxy->m_collisionFilterGroup, proxy->m_collisionFilterMask);
+		broadphase.destroyProxy(proxy, dispatcher);
+		objects[i]->setBroadphaseHandle(nullptr);
+	}
+
+	// With no proxies left this puts the trees and unique ids back to how a new broadphase starts
+	broadphase.resetPool(dispatcher);
+
+	// Exactly as btCollisionWorld::addCollisionObject creates them
+	for(int i = 0; i < objects.size(); ++i)
+	{
+		btCollisionObject* object = objects[i];
+		btVector3 aabbMin, aabbMax;
+		object->getCollisionShape()->getAabb(object->getWorldTransform(), aabbMin, aabbMax);
+		object->setBroadphaseHandle(broadphase.createProxy(aabbMin, aabbMax, object->getCollisionShape()->getShapeType(),
+														   object, filters[i].first, filters[i].second, dispatcher, 0));
+	}
+}
+
+/**
+ * Record every non-static body, constraint and multibody in the world. The broadphase is rebuilt the same way a
+ * restore rebuilds it, so the run from here and every run after a restore start from identical states.
+ */
+void CWorldSnapshot::Capture(btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld, btDbvtBroadphase& broadphase)
+{
+	Clear();
+
+	btCollisionObjectArray& objects = world.getCollisionObjectArray();
+	for(int i = 0; i < objects.size(); ++i)
+	{
+		btRigidBody* body = btRigidBody::upcast(objects[i]);
+		if(!body || body->isStaticObject())
+			continue;
+
+		// Bodies placed by ARGoS still have the inertia of where they were created
+		body->updateInertiaTensor();
+
+		bodies.push_back(SBodyState{body, body->getWorldTransform(), body->getLinearVelocity(),
+									body->getAngularVelocity(), body->getActivationState(), body->getDeactivationTime()});
+	}
+
+	for(int i = 0; i < world.getNumConstraints(); ++i)
+	{
+		btTypedConstraint* constraint = world.getConstraint(i);
+		constraints.push_back(SConstraintState{constraint, constraint->isEnabled(), constraint->getBreakingImpulseThreshold()});
+	}
+
+	for(int i = 0; multiBodyWorld && i < multiBodyWorld->getNumMultibodies(); ++i)
+	{
+		btMultiBody* multiBody = multiBodyWorld->getMultiBody(i);
+		multiBodies.push_back(SMultiBodyState{multiBody, multiBody->getBaseWorldTransform(), multiBody->getBaseVel(),
+											  multiBody->getBaseOmega(), (int)multiBodyValues.size(), multiBody->isAwake()});
+		CaptureMultiBody(*multiBody, multiBodyValues);
+	}
+
+	RebuildBroadphase(world, broadphase);
+	captured = true;
+}
+
+/**
+ * Put every recorded body back, then rebuild the broadphase. Contacts from before the restore are meaningless,
+ * dropping the pairs drops their manifolds too.
+ */
+void CWorldSnapshot::Restore(btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld,
+							 btDbvtBroadphase& broadphase) const
+{
+	for(auto& state : bodies)
+		RestoreBody(*state.body, state.transform, state.linearVelocity, state.angularVelocity, state.activationState,
+					state.deactivationTime);
+
+	for(auto& state : constraints)
+	{
+		state.constraint->setEnabled(state.enabled);
+		state.constraint->setBreakingImpulseThreshold(state.breakingThreshold);
+	}
+
+	for(auto& state : multiBodies)
+		RestoreMultiBody(*state.multiBody, state.baseTransform, state.baseVelocity, state.baseOmega,
+						 multiBodyValues.data() + state.firstValue, state.awake);
+
+	RebuildBroadphase(world, broadphase);
+}
+
+/**
+ * Move a body and set its velocities, clearing anything it had accumulated since
+ */
+void CWorldSnapshot::RestoreBody(btRigidBody& body, const btTransform& transform, const btVector3& linearVelocity,
+								 const btVector3& angularVelocity, int activationState, btScalar deactivationTime)
+{
+	body.setWorldTransform(transform);
+	body.setInterpolationWorldTransform(transform);
+	if(body.getMotionState())
+		body.getMotionState()->setWorldTransform(transform);
+
+	body.setLinearVelocity(linearVelocity);
+	body.setAngularVelocity(angularVelocity);
+	body.setInterpolationLinearVelocity(linearVelocity);
+	body.setInterpolationAngularVelocity(angularVelocity);
+	body.clearForces();
+	body.updateInertiaTensor();
+
+	body.forceActivationState(activationState);
+	body.setDeactivationTime(deactivationTime);
+}
+
+/**
+ * Each link's joint positions then its joint velocities
+ */
+void CWorldSnapshot::CaptureMultiBody(const btMultiBody& multiBody, std::vector<btScalar>& values)
+{
+	for(int link = 0; link < multiBody.getNumLinks(); ++link)
+	{
+		const btMultibodyLink& linkData = multiBody.getLink(link);
+		const btScalar* positions = multiBody.getJointPosMultiDof(link);
+		const btScalar* velocities = multiBody.getJointVelMultiDof(link);
+		values.insert(values.end(), positions, positions + linkData.m_posVarCount);
+		values.insert(values.end(), velocities, velocities + linkData.m_dofCount);
+	}
+}
+
+/**
+ * Set the base and joints, then bring the links' colliders and sleeping state in line with them
+ */
+void CWorldSnapshot::RestoreMultiBody(btMultiBody& multiBody, const btTransform& baseTransform,
+									  const btVector3& baseVelocity, const btVector3& baseOmega, const btScalar* values,
+									  bool awake)
+{
+	multiBody.setBaseWorldTransform(baseTransform);
+	multiBody.setBaseVel(baseVelocity);
+	multiBody.setBaseOmega(baseOmega);
+	multiBody.clearForcesAndTorques();
+
+	for(int link = 0; link < multiBody.getNumLinks(); ++link)
+	{
+		btMultibodyLink& linkData = multiBody.getLink(link);
+		std::copy(values, values + linkData.m_posVarCount, multiBody.getJointPosMultiDof(link));
+		values += linkData.m_posVarCount;
+		std::copy(values, values + linkData.m_dofCount, multiBody.getJointVelMultiDof(link));
+		values += linkData.m_dofCount;
+
+		// Setting positions directly skips the cached joint transform
+		linkData.updateCacheMultiDof();
+	}
+
+	btAlignedObjectArray<btQuaternion> scratchRotations;
+	btAlignedObjectArray<btVector3> scratchVectors;
+	multiBody.forwardKinematics(scratchRotations, scratchVectors);
+	multiBody.updateCollisionObjectWorldTransforms(scratchRotations, scratchVectors);
+
+	// The sleep timer can't be set directly but checking motion on a body which can't sleep zeroes it
+	bool canSleep = multiBody.getCanSleep();
+	multiBody.setCanSleep(false);
+	multiBody.checkMotionAndSleepIfRequired(0);
+	multiBody.setCanSleep(canSleep);
+
+	if(awake)
+		multiBody.wakeUp();
+	else
+		multiBody.goToSleep();
+
+	// Colliders normally follow their btMultiBody's activation during the step
+	int activation = awake ? ACTIVE_TAG : ISLAND_SLEEPING;
+	for(int link = -1; link < multiBody.getNumLinks(); ++link)
+	{
+		btMultiBodyLinkCollider* collider = link < 0 ? multiBody.getBaseCollider() : multiBody.getLink(link).m_collider;
+		if(collider)
+			collider->forceActivationState(activation);
+	}
+}
+
+/**
+ * Stop restoring a body which has been removed from the world
+ */
+void CWorldSnapshot::Forget(const btCollisionObject* object)
+{
+	bodies.erase(std::remove_if(bodies.begin(), bodies.end(), [&](const SBodyState& state)
+	{
+		return state.body == object;
+	}), bodies.end());
+}
+
+/**
+ * Stop restoring a constraint which has been removed from the world
+ */
+void CWorldSnapshot::Forget(const btTypedConstraint* constraint)
+{
+	constraints.erase(std::remove_if(constraints.begin(), constraints.end(), [&](const SConstraintState& state)
+	{
+		return state.constraint == constraint;
+	}), constraints.end());
+}
+
+/**
+ * Stop restoring a btMultiBody which has been removed from the world, its joint values are left unused
+ */
+void CWorldSnapshot::Forget(const btMultiBody* multiBody)
+{
+	multiBodies.erase(std::remove_if(multiBodies.begin(), multiBodies.end(), [&](const SMultiBodyState& state)
+	{
+		return state.multiBody == multiBody;
+	}), multiBodies.end());
+}
+
+/**
+ * Forget everything, the next capture starts afresh
+ */
+void CWorldSnapshot::Clear()
+{
+	bodies.clear();
+	constraints.clear();
+	multiBodies.clear();
+	multiBodyValues.clear();
+	captured = false;
+}
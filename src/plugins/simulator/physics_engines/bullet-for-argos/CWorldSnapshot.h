@@ -0,0 +1,94 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CWORLDSNAPSHOT_H
+#define ARGOS3_BULLET_CWORLDSNAPSHOT_H
+
+#include "./bullet/src/btBulletDynamicsCommon.h"
+
+#include <vector>
+
+class btDbvtBroadphase;
+class btMultiBody;
+class btMultiBodyDynamicsWorld;
+
+/**
+ * The state of everything that can move in a world, held as flat arrays so it can be captured once and
+ * restored in bulk. Restoring also rebuilds the broadphase, dropping every overlapping pair along with
+ * their contact manifolds and warm starting impulses, so nothing from before the restore carries over.
+ */
+class CWorldSnapshot
+{
+public:
+	void Capture(btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld, btDbvtBroadphase& broadphase);
+	void Restore(btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld, btDbvtBroadphase& broadphase) const;
+
+	// Stop tracking anything which is leaving the world
+	void Forget(const btCollisionObject* object);
+	void Forget(const btTypedConstraint* constraint);
+	void Forget(const btMultiBody* multiBody);
+
+	bool IsCaptured() const { return captured; }
+	void Clear();
+
+	// Put a single body back, shared with checkpoints which store the same state on disk
+	static void RestoreBody(btRigidBody& body, const btTransform& transform, const btVector3& linearVelocity,
+							const btVector3& angularVelocity, int activationState, btScalar deactivationTime);
+
+	// Put a multibody back from its joint positions then velocities for each link in turn
+	static void RestoreMultiBody(btMultiBody& multiBody, const btTransform& baseTransform, const btVector3& baseVelocity,
+								 const btVector3& baseOmega, const btScalar* values, bool awake);
+
+	// Joint positions and velocities which RestoreMultiBody expects, appended to values
+	static void CaptureMultiBody(const btMultiBody& multiBody, std::vector<btScalar>& values);
+
+	// Recreate every proxy so nothing from before a restore carries over
+	static void RebuildBroadphase(btDynamicsWorld& world, btDbvtBroadphase& broadphase);
+
+private:
+	/**
+	 * A rigid body which may move
+	 */
+	struct SBodyState
+	{
+		btRigidBody* body;
+		btTransform transform;
+		btVector3 linearVelocity;
+		btVector3 angularVelocity;
+		int activationState;
+		btScalar deactivationTime;
+	};
+
+	/**
+	 * Constraints can be disabled by breaking, which would otherwise outlive a reset
+	 */
+	struct SConstraintState
+	{
+		btTypedConstraint* constraint;
+		bool enabled;
+		btScalar breakingThreshold;
+	};
+
+	/**
+	 * A reduced coordinate body, its joint positions and velocities are ranges of multiBodyValues
+	 */
+	struct SMultiBodyState
+	{
+		btMultiBody* multiBody;
+		btTransform baseTransform;
+		btVector3 baseVelocity;
+		btVector3 baseOmega;
+		int firstValue;
+		bool awake;
+	};
+
+	std::vector<SBodyState> bodies;
+	std::vector<SConstraintState> constraints;
+	std::vector<SMultiBodyState> multiBodies;
+	std::vector<btScalar> multiBodyValues;
+
+	bool captured{false};
+};
+
+#endif //ARGOS3_BULLET_CWORLDSNAPSHOT_H
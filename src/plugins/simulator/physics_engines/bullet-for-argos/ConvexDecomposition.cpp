@@ -0,0 +1,249 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "ConvexDecomposition.h"
+#include "AssetCache.h"
+
+#include "./bullet/src/LinearMath/btConvexHullComputer.h"
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+/**
+ * Identifies a decomposition cache file, bump the version if the format or algorithm changes
+ */
+static const char DECOMPOSITION_CACHE_MAGIC[8] = {'B', 'F', 'A', 'D', 'C', 'M', 'P', '1'};
+
+/**
+ * A cut must remove at least this fraction of a part's hull volume to be kept
+ */
+static const btScalar MIN_CUT_GAIN = btScalar(0.05);
+
+/**
+ * Parts with less than this fraction of the whole mesh's hull volume are never cut
+ */
+static const btScalar MIN_PART_VOLUME = btScalar(0.001);
+
+/**
+ * Cut positions tried along each axis, as fractions of the part's extent
+ */
+static const btScalar CUT_POSITIONS[] = {btScalar(0.25), btScalar(0.5), btScalar(0.75)};
+
+/**
+ * Triangles of the whole mesh with their vertices already scaled
+ */
+struct STriangleSoup
+{
+	THullPoints points;				// Every vertex of every sub-mesh
+	std::vector<int> indices;		// Three per triangle, into points
+	THullPoints centroids;			// Centre of each triangle, used to decide which side of a cut it is on
+};
+
+/**
+ * One part of the decomposition
+ */
+struct SPart
+{
+	std::vector<int> triangles;		// Which triangles of the soup it holds
+	btScalar volume;				// Volume of its convex hull
+	bool settled;					// Set once no cut is worth making
+};
+
+/**
+ * Volume of a computed hull, summing the tetrahedra between the first vertex and each face
+ */
+static btScalar hullVolume(const btConvexHullComputer& hull)
+{
+	if(hull.vertices.size() < 4)
+		return 0;
+
+	const btVector3& apex = hull.vertices[0];
+	btScalar volume = 0;
+	for(int f = 0; f < hull.faces.size(); ++f)
+	{
+		// Faces are polygons so fan them out from their first vertex
+		const btConvexHullComputer::Edge* first = &hull.edges[hull.faces[f]];
+		const btVector3& a = hull.vertices[first->getSourceVertex()];
+		const btConvexHullComputer::Edge* edge = first->getNextEdgeOfFace();
+		while(edge->getTargetVertex() != first->getSourceVertex())
+		{
+			const btVector3& b = hull.vertices[edge->getSourceVertex()];
+			const btVector3& c = hull.vertices[edge->getTargetVertex()];
+			volume += (a - apex).dot((b - apex).cross(c - apex));
+			edge = edge->getNextEdgeOfFace();
+		}
+	}
+
+	return btFabs(volume) / 6;
+}
+
+/**
+ * Gather the vertices of a set of triangles
+ */
+static void partPoints(const STriangleSoup& soup, const std::vector<int>& triangles, THullPoints& points)
+{
+	points.resize(0);
+	for(int triangle : triangles)
+		for(int corner = 0; corner < 3; ++corner)
+			points.push_back(soup.points[soup.indices[3 * triangle + corner]]);
+}
+
+/**
+ * Volume of the convex hull of a set of triangles
+ */
+static btScalar partVolume(const STriangleSoup& soup, const std::vector<int>& triangles)
+{
+	THullPoints points;
+	partPoints(soup, triangles, points);
+	if(points.size() < 4)
+		return 0;
+
+	btConvexHullComputer computer;
+	computer.compute(&points[0].x(), sizeof(btVector3), points.size(), 0, 0);
+	return hullVolume(computer);
+}
+
+/**
+ * Find the axis aligned cut which leaves the least total hull volume. Returns false if none is worth making.
+ */
+static bool cutPart(const STriangleSoup& soup, const SPart& part, SPart& below, SPart& above)
+{
+	btVector3 lower{BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT};
+	btVector3 upper = -lower;
+	for(int triangle : part.triangles)
+	{
+		lower.setMin(soup.centroids[triangle]);
+		upper.setMax(soup.centroids[triangle]);
+	}
+
+	btScalar bestVolume = part.volume * (1 - MIN_CUT_GAIN);
+	bool found = false;
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		for(btScalar position : CUT_POSITIONS)
+		{
+			btScalar plane = lower[axis] + position * (upper[axis] - lower[axis]);
+
+			// Triangles go wholly to one side so neighbouring parts overlap slightly rather than leaving gaps
+			SPart candidateBelow{{}, 0, false}, candidateAbove{{}, 0, false};
+			for(int triangle : part.triangles)
+				(soup.centroids[triangle][axis] < plane ? candidateBelow : candidateAbove).triangles.push_back(triangle);
+
+			if(candidateBelow.triangles.empty() || candidateAbove.triangles.empty())
+				continue;
+
+			candidateBelow.volume = partVolume(soup, candidateBelow.triangles);
+			candidateAbove.volume = partVolume(soup, candidateAbove.triangles);
+			if(candidateBelow.volume + candidateAbove.volume < bestVolume)
+			{
+				bestVolume = candidateBelow.volume + candidateAbove.volume;
+				below = std::move(candidateBelow);
+				above = std::move(candidateAbove);
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+/**
+ * Flatten every sub-mesh into one scaled triangle soup
+ */
+static void buildSoup(const MeshInfo& mesh, const btVector3& scale, STriangleSoup& soup)
+{
+	for(auto& subMesh : mesh.subMeshes)
+	{
+		const int* indices = subMesh.indices;
+		int offset = soup.points.size();
+
+		for(unsigned long p = 0; p < subMesh.numVertices; ++p)
+		{
+			const float* position = subMesh.vertices[p].position;
+			soup.points.push_back(btVector3{position[0], position[1], position[2]} * scale);
+		}
+
+		for(unsigned long i = 0; i + 2 < subMesh.numIndices; i += 3)
+		{
+			for(int corner = 0; corner < 3; ++corner)
+				soup.indices.push_back(offset + indices[i + corner]);
+
+			soup.centroids.push_back((soup.points[offset + indices[i]] + soup.points[offset + indices[i + 1]] +
+									  soup.points[offset + indices[i + 2]]) / 3);
+		}
+	}
+}
+
+/**
+ * Greedily cut the part with the largest hull until there are enough parts or no cut helps
+ */
+static void decompose(const STriangleSoup& soup, int maxHulls, int maxVertices, btAlignedObjectArray<THullPoints>& hulls)
+{
+	std::vector<SPart> parts(1);
+	for(int triangle = 0; triangle < soup.centroids.size(); ++triangle)
+		parts[0].triangles.push_back(triangle);
+	parts[0].volume = partVolume(soup, parts[0].triangles);
+	parts[0].settled = false;
+
+	btScalar minVolume = parts[0].volume * MIN_PART_VOLUME;
+	while((int)parts.size() < maxHulls)
+	{
+		int largest = -1;
+		for(int i = 0; i < (int)parts.size(); ++i)
+			if(!parts[i].settled && (largest < 0 || parts[i].volume > parts[largest].volume))
+				largest = i;
+
+		if(largest < 0)
+			break;
+
+		SPart below, above;
+		if(parts[largest].volume <= minVolume || !cutPart(soup, parts[largest], below, above))
+		{
+			parts[largest].settled = true;
+			continue;
+		}
+
+		parts[largest] = std::move(below);
+		parts.push_back(std::move(above));
+	}
+
+	hulls.resize(0);
+	for(auto& part : parts)
+	{
+		THullPoints points, hull;
+		partPoints(soup, part.triangles, points);
+		reduceToConvexHull(points.size() ? &points[0] : nullptr, points.size(), maxVertices, hull);
+		if(hull.size())
+			hulls.push_back(hull);
+	}
+}
+
+/**
+ * Decompose the mesh, going via the asset cache when the mesh came from a file
+ */
+void decomposeMesh(const MeshInfo& mesh, const btVector3& scale, int maxHulls, int maxVertices,
+				   ConvexDecomposition& decomposition)
+{
+	std::string cacheFile;
+	uint64_t meshHash = 0;
+
+	if(!mesh.sourceFile.empty())
+	{
+		std::ostringstream tag;
+		tag << std::setprecision(9) << "decomp_" << scale.x() << "_" << scale.y() << "_" << scale.z() << "_" << maxHulls << "_" << maxVertices;
+		cacheFile = assetCachePath(mesh.sourceFile, tag.str());
+		meshHash = hashFile(mesh.sourceFile);
+
+		if(readHullSetCache(cacheFile, DECOMPOSITION_CACHE_MAGIC, meshHash, -1, decomposition.hulls))
+			return;
+	}
+
+	STriangleSoup soup;
+	buildSoup(mesh, scale, soup);
+	decompose(soup, maxHulls, maxVertices, decomposition.hulls);
+
+	if(!cacheFile.empty())
+		writeHullSetCache(cacheFile, DECOMPOSITION_CACHE_MAGIC, meshHash, decomposition.hulls);
+}
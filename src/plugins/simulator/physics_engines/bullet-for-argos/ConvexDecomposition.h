@@ -0,0 +1,29 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CONVEXDECOMPOSITION_H
+#define ARGOS3_BULLET_CONVEXDECOMPOSITION_H
+
+#include "ConvexHullReduction.h"
+#include "MeshInfo.h"
+
+/**
+ * Approximate convex decomposition of a (possibly concave) mesh into a few small hulls.
+ * The points are already scaled so the hulls can be used as they are.
+ */
+struct ConvexDecomposition
+{
+	btAlignedObjectArray<THullPoints> hulls;	// Points of each convex part
+};
+
+/**
+ * Split the triangles of every sub-mesh into at most maxHulls roughly convex parts and reduce each one to a
+ * hull of at most maxVertices points. Parts are cut in two along axis aligned planes for as long as the cut
+ * removes a worthwhile amount of empty hull volume. Results are read from the asset cache if possible,
+ * otherwise built and saved there.
+ */
+void decomposeMesh(const MeshInfo& mesh, const btVector3& scale, int maxHulls, int maxVertices,
+				   ConvexDecomposition& decomposition);
+
+#endif //ARGOS3_BULLET_CONVEXDECOMPOSITION_H
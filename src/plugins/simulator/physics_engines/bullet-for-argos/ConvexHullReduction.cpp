@@ -0,0 +1,179 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "ConvexHullReduction.h"
+#include "AssetCache.h"
+
+#include "./bullet/src/LinearMath/btConvexHullComputer.h"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Identifies a hull cache file, bump the version if the format or reduction changes
+ */
+static const char HULL_CACHE_MAGIC[8] = {'B', 'F', 'A', 'H', 'U', 'L', 'L', '1'};
+
+/**
+ * Compute the exact hull then keep the most extreme point along each of maxVertices directions
+ */
+void reduceToConvexHull(const btVector3* points, int numPoints, int maxVertices, THullPoints& hull)
+{
+	hull.clear();
+	if(numPoints <= 0)
+		return;
+
+	btConvexHullComputer computer;
+	computer.compute(&points[0].x(), sizeof(btVector3), numPoints, 0, 0);
+
+	// Small enough already
+	if(computer.vertices.size() <= maxVertices)
+	{
+		hull = computer.vertices;
+		return;
+	}
+
+	// Directions spread evenly over the sphere (Fibonacci lattice)
+	btAlignedObjectArray<bool> used;
+	used.resize(computer.vertices.size(), false);
+	const btScalar goldenAngle = SIMD_PI * (btScalar(3) - btSqrt(btScalar(5)));
+
+	for(int i = 0; i < maxVertices; ++i)
+	{
+		btScalar z = 1 - (2 * (i + btScalar(0.5))) / maxVertices;
+		btScalar r = btSqrt(btMax(btScalar(0), 1 - z * z));
+		btScalar phi = goldenAngle * i;
+		btVector3 direction{r * btCos(phi), r * btSin(phi), z};
+
+		int best = 0;
+		btScalar bestDot = computer.vertices[0].dot(direction);
+		for(int v = 1; v < computer.vertices.size(); ++v)
+		{
+			btScalar dot = computer.vertices[v].dot(direction);
+			if(dot > bestDot)
+			{
+				best = v;
+				bestDot = dot;
+			}
+		}
+
+		// Several directions can pick the same point, only keep it once
+		if(!used[best])
+		{
+			used[best] = true;
+			hull.push_back(computer.vertices[best]);
+		}
+	}
+}
+
+/**
+ * Read a set of hulls, checking the magic, the hash and (unless it's negative) the number of hulls
+ */
+bool readHullSetCache(const std::string& cacheFile, const char* magicId, uint64_t meshHash, int numHulls,
+					  btAlignedObjectArray<THullPoints>& hulls)
+{
+	std::vector<char> data;
+	if(!readAssetCache(cacheFile, data))
+		return false;
+
+	size_t offset = 0;
+	char magic[8];
+	uint64_t hash;
+	uint32_t count;
+	if(!readFromCache(data, offset, magic, 8) || memcmp(magic, magicId, 8) != 0 ||
+	   !readFromCache(data, offset, &hash, 1) || hash != meshHash ||
+	   !readFromCache(data, offset, &count, 1) || (numHulls >= 0 && (int)count != numHulls))
+		return false;
+
+	// A damaged count mustn't be trusted with an allocation, each hull takes at least its point count
+	if(count > (data.size() - offset) / sizeof(uint32_t))
+		return false;
+
+	hulls.resize((int)count);
+	for(int i = 0; i < (int)count; ++i)
+	{
+		uint32_t numPoints;
+		if(!readFromCache(data, offset, &numPoints, 1) || numPoints > (data.size() - offset) / (3 * sizeof(float)))
+			return false;
+
+		hulls[i].resize(numPoints);
+		for(uint32_t p = 0; p < numPoints; ++p)
+		{
+			float xyz[3];
+			if(!readFromCache(data, offset, xyz, 3))
+				return false;
+			hulls[i][p].setValue(xyz[0], xyz[1], xyz[2]);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Save hulls along with the hash of the mesh they came from
+ */
+void writeHullSetCache(const std::string& cacheFile, const char* magicId, uint64_t meshHash,
+					   const btAlignedObjectArray<THullPoints>& hulls)
+{
+	std::vector<char> data;
+	uint32_t count = (uint32_t)hulls.size();
+	appendToCache(data, magicId, 8);
+	appendToCache(data, &meshHash, 1);
+	appendToCache(data, &count, 1);
+
+	for(int i = 0; i < hulls.size(); ++i)
+	{
+		uint32_t numPoints = (uint32_t)hulls[i].size();
+		appendToCache(data, &numPoints, 1);
+
+		for(int p = 0; p < hulls[i].size(); ++p)
+		{
+			float xyz[3] = {(float)hulls[i][p].x(), (float)hulls[i][p].y(), (float)hulls[i][p].z()};
+			appendToCache(data, xyz, 3);
+		}
+	}
+
+	writeAssetCache(cacheFile, data);
+}
+
+/**
+ * Reduce each sub-mesh, going via the asset cache when the mesh came from a file
+ */
+void getMeshHulls(const MeshInfo& mesh, const btVector3& scale, int maxVertices, btAlignedObjectArray<THullPoints>& hulls)
+{
+	std::string cacheFile;
+	uint64_t meshHash = 0;
+
+	if(!mesh.sourceFile.empty())
+	{
+		std::ostringstream tag;
+		tag << std::setprecision(9) << "hull_" << scale.x() << "_" << scale.y() << "_" << scale.z() << "_" << maxVertices;
+		cacheFile = assetCachePath(mesh.sourceFile, tag.str());
+		meshHash = hashFile(mesh.sourceFile);
+
+		if(readHullSetCache(cacheFile, HULL_CACHE_MAGIC, meshHash, (int)mesh.subMeshes.size(), hulls))
+			return;
+	}
+
+	hulls.resize((int)mesh.subMeshes.size());
+	for(int i = 0; i < (int)mesh.subMeshes.size(); ++i)
+	{
+		const SubMesh& subMesh = mesh.subMeshes[i];
+		int numPoints = (int)subMesh.numVertices;
+
+		THullPoints points;
+		points.resize(numPoints);
+		for(int p = 0; p < numPoints; ++p)
+		{
+			const float* position = subMesh.vertices[p].position;
+			points[p] = btVector3{position[0], position[1], position[2]} * scale;
+		}
+
+		reduceToConvexHull(numPoints ? &points[0] : nullptr, numPoints, maxVertices, hulls[i]);
+	}
+
+	if(!cacheFile.empty())
+		writeHullSetCache(cacheFile, HULL_CACHE_MAGIC, meshHash, hulls);
+}
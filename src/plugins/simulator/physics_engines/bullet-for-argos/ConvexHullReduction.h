@@ -0,0 +1,45 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_CONVEXHULLREDUCTION_H
+#define ARGOS3_BULLET_CONVEXHULLREDUCTION_H
+
+#include "./bullet/src/LinearMath/btAlignedObjectArray.h"
+#include "./bullet/src/LinearMath/btVector3.h"
+#include "MeshInfo.h"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Points of a single convex hull
+ */
+using THullPoints = btAlignedObjectArray<btVector3>;
+
+/**
+ * Scale a set of points and reduce them to at most maxVertices points on their convex hull. The exact hull
+ * is computed first and, if it is too large, the points furthest along evenly spread directions are kept.
+ */
+void reduceToConvexHull(const btVector3* points, int numPoints, int maxVertices, THullPoints& hull);
+
+/**
+ * Reduced hull of every sub-mesh of a mesh at the given scale, in the same order as the mesh's sub-meshes.
+ * Results are read from the asset cache if possible, otherwise built and saved there.
+ */
+void getMeshHulls(const MeshInfo& mesh, const btVector3& scale, int maxVertices, btAlignedObjectArray<THullPoints>& hulls);
+
+/**
+ * Read a set of hulls saved by writeHullSetCache. The 8 character magic and the source mesh's hash must match
+ * and, unless numHulls is negative, so must the number of hulls.
+ */
+bool readHullSetCache(const std::string& cacheFile, const char* magicId, uint64_t meshHash, int numHulls,
+					  btAlignedObjectArray<THullPoints>& hulls);
+
+/**
+ * Save a set of hulls to the asset cache under an 8 character magic identifying what they are
+ */
+void writeHullSetCache(const std::string& cacheFile, const char* magicId, uint64_t meshHash,
+					   const btAlignedObjectArray<THullPoints>& hulls);
+
+#endif //ARGOS3_BULLET_CONVEXHULLREDUCTION_H
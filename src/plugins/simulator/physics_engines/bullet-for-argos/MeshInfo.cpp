@@ -3,81 +3,205 @@
 //
 
 #include "tinyobjloader/tiny_obj_loader.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include "MeshInfo.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 using namespace tinyobj;
 
+/*
+ * Binary mesh format. A header and a table of sub-meshes are followed by a string table holding
+ * sub-mesh names and texture file names, then the mesh storage exactly as it is laid out in memory.
+ * The storage and every block inside it are 16 byte aligned so it can be used directly from a
+ * mapping of the file.
+ */
+
 /**
- * Used to load OBJ files (currently the only mesh type supported)
- * and associated texture files
+ * Identifies a binary mesh file, bump the version if the layout changes
  */
-bool MeshInfo::LoadFromFile(std::string sourceFile)
+static const char BINARY_MESH_MAGIC[8] = {'B', 'F', 'A', 'M', 'E', 'S', 'H', '2'};
+
+/**
+ * No texture file for a sub-mesh
+ */
+static const uint32_t NO_TEXTURE = 0xFFFFFFFF;
+
+/**
+ * Start of a binary mesh file
+ */
+struct SBinaryMeshHeader
 {
-	// Clear and deallocate any old data.
-	ClearData(true);
+	char magic[8];
+	uint64_t sourceHash;			// Hash of the file the mesh was converted from, 0 if unknown
+	uint32_t numSubMeshes;
+	uint32_t stringTableSize;
+	uint64_t stringTableOffset;
+	uint64_t storageOffset;
+	uint64_t storageSize;
+};
 
-	// Where to store the parsed data
-	std::vector<shape_t> shapes;
-	std::vector<material_t> mats;
+/**
+ * Where one sub-mesh's data is, offsets are from the start of the storage
+ */
+struct SBinarySubMesh
+{
+	uint64_t vertexOffset;
+	uint64_t numVertices;
+	uint64_t indexOffset;
+	uint64_t numIndices;
+	uint32_t nameOffset;			// Into the string table
+	uint32_t textureOffset;			// Into the string table, NO_TEXTURE if there isn't one
+	uint32_t hasUvs;
+	uint32_t padding;
+};
 
-	// Get the directory that this mesh exists in
-	int pathEnd = sourceFile.find_last_of('/');
-	std::string dir = sourceFile.substr(0, pathEnd + 1);
+/**
+ * Round an offset up to the next block boundary
+ */
+static inline uint64_t alignBlock(uint64_t offset)
+{
+	return (offset + 15) & ~(uint64_t)15;
+}
 
-	// Try to parse the OBJ file
-	std::string err = LoadObj(shapes, mats, sourceFile.c_str(), dir.c_str());
+/**
+ * Offsets of each sub-mesh's vertex and index blocks within the storage, returning the total storage size
+ */
+static uint64_t layoutStorage(const std::vector<SubMesh>& subMeshes, std::vector<SBinarySubMesh>& layout)
+{
+	uint64_t offset = 0;
+	layout.resize(subMeshes.size());
+	for (size_t i = 0; i < subMeshes.size(); ++i) {
+		layout[i].vertexOffset = offset;
+		layout[i].numVertices = subMeshes[i].numVertices;
+		offset = alignBlock(offset + subMeshes[i].numVertices * sizeof(MeshVertex));
+
+		layout[i].indexOffset = offset;
+		layout[i].numIndices = subMeshes[i].numIndices;
+		offset = alignBlock(offset + subMeshes[i].numIndices * sizeof(int));
+	}
+	return offset;
+}
 
-	// Somewhere to store required material definitions
-	MeshTexture *loadedTextures[mats.size()];
+/**
+ * Every texture loaded so far, by canonical path. Textures live as long as the process as the
+ * renderer may hold IDs for them.
+ */
+static std::map<std::string, MeshTexture*> textureCache;
+static std::mutex textureMutex;
 
-	// Load all materials
-	for (int i = 0; i < mats.size(); ++i) {
-		// Get the current material
-		auto &mat = mats[i];
+/**
+ * Look the image up by its real path so the same file reached through different meshes is only loaded once
+ */
+MeshTexture* getMeshTexture(const std::string& fileName)
+{
+	char* resolved = realpath(fileName.c_str(), nullptr);
+	std::string key = resolved ? resolved : fileName;
+	free(resolved);
+
+	std::lock_guard<std::mutex> lock(textureMutex);
+	MeshTexture*& texture = textureCache[key];
+	if (!texture) {
+		texture = new MeshTexture;
+		texture->file = key;
+	}
+	return texture;
+}
 
-		// Allocate a new mesh object
-		loadedTextures[i] = new MeshTexture;
+/**
+ * Decode straight into stb_image's buffer, images which fail to load are only tried once
+ */
+bool MeshTexture::Decode()
+{
+	std::lock_guard<std::mutex> lock(textureMutex);
+	if (data != nullptr)
+		return true;
+	if (failed)
+		return false;
 
-		// Get the mesh texture object we just created
-		auto loadedMat = loadedTextures[i];
+	int components;
+	stbi_set_flip_vertically_on_load(1);
+	data = stbi_load(file.c_str(), &width, &height, &components, 4);
+	if (data == nullptr) {
+		failed = true;
+		width = height = -1;
+	}
 
-		// What is the name of the texture file we should use?
-		auto filename = mat.diffuse_texname.c_str();
-		int width, height, components;
+	return data != nullptr;
+}
 
-		// Clear the renderer texture ID, we are about to load new data
-		loadedMat->renderId = 0;
+/**
+ * Drop the pixels but keep the size and render ID
+ */
+void MeshTexture::ReleaseData()
+{
+	std::lock_guard<std::mutex> lock(textureMutex);
+	stbi_image_free(data);
+	data = nullptr;
+}
 
-		stbi_set_flip_vertically_on_load(1);
-		// Load the new image file into an unsigned char array using stb_image
-		auto data = stbi_load((dir + filename).c_str(), &width, &height, &components, 4);
+/**
+ * Text based formats can't be told apart by their contents, so go by extension
+ */
+static bool hasExtension(const std::string& fileName, const std::string& extension)
+{
+	return fileName.size() >= extension.size() &&
+		   fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+}
 
-		// Number of data elements we need to copy
-		int numElements = width * height * 4;
+bool MeshInfo::IsLoadable(const std::string& fileName)
+{
+	return hasExtension(fileName, ".obj") || hasExtension(fileName, ".bmesh");
+}
 
-		if (data != nullptr) {
-			// Allocate new space to store the image data
-			loadedMat->data = new unsigned char[numElements];    //(unsigned char*)malloc(numElements * sizeof(unsigned char));
+/**
+ * Used to load OBJ files (the only source format supported) and binary meshes
+ */
+bool MeshInfo::LoadFromFile(std::string sourceFile)
+{
+	// Clear and deallocate any old data.
+	ClearData(true);
+	this->sourceFile = sourceFile;
 
-			// Copy the loaded data to our mesh texture's array
-			memcpy(loadedMat->data, data, numElements * sizeof(unsigned char));
+	// Binary meshes are used as they are
+	if (hasExtension(sourceFile, ".bmesh"))
+		return LoadFromBinary(sourceFile);
 
-			// Set our texture size
-			loadedMat->height = height;
-			loadedMat->width = width;
+	// Use the converted copy of an OBJ file as long as it is up to date
+	std::string binaryFile = assetCachePath(sourceFile, "bmesh");
+	uint64_t sourceHash = hashFile(sourceFile);
+	if (sourceHash != 0 && LoadFromBinary(binaryFile, sourceHash))
+		return true;
 
-			// Clear the loaded data
-			free(data);
-		}
-		else {
-			loadedMat->data = nullptr;
-			loadedMat->height = -1;
-			loadedMat->width = -1;
-		}
-	}
+	if (!LoadFromObj(sourceFile))
+		return false;
+
+	// Convert it for next time
+	if (sourceHash != 0)
+		SaveToBinary(binaryFile, sourceHash);
+
+	return true;
+}
+
+/**
+ * Parse the OBJ with tinyobjloader and copy the parts we need into one block of storage
+ */
+bool MeshInfo::LoadFromObj(const std::string& objFile)
+{
+	// Where to store the parsed data
+	std::vector<shape_t> shapes;
+	std::vector<material_t> mats;
+
+	// Get the directory that this mesh exists in
+	int pathEnd = objFile.find_last_of('/');
+	std::string dir = objFile.substr(0, pathEnd + 1);
+
+	// Try to parse the OBJ file
+	std::string err = LoadObj(shapes, mats, objFile.c_str(), dir.c_str());
 
 	// Abort if an error has occurred
 	if (!err.empty())
@@ -88,85 +212,183 @@ bool MeshInfo::LoadFromFile(std::string sourceFile)
 	if (nShapes == 0)
 		return false;
 
-	// Iterate over all bodies
-	for (int i = 0; i < nShapes; ++i) {
-		// Get the name and mesh datal
-		auto shapeName = shapes[i].name;
-		auto mesh = shapes[i].mesh;
-
-		// Extract all vertices
-		float *verts = new float[mesh.positions.size()];
+	// Describe every sub-mesh first so the storage can be allocated in one go
+	subMeshes.resize(nShapes);
+	for (unsigned long i = 0; i < nShapes; ++i) {
+		const mesh_t& mesh = shapes[i].mesh;
+		SubMesh& subMesh = subMeshes[i];
+		subMesh.name = shapes[i].name;
+		subMesh.numVertices = mesh.positions.size() / 3;
+		subMesh.numIndices = mesh.indices.size();
+
+		// tinyobjloader only gives texture coordinates for vertices which have them, so they only line up if all do
+		subMesh.hasUvs = mesh.texcoords.size() == 2 * subMesh.numVertices;
+
+		int material = mesh.material_ids.empty() ? -1 : mesh.material_ids[0];
+		if (material >= 0) {
+			subMesh.texture = getMeshTexture(dir + mats[material].diffuse_texname);
+			subMesh.textureFile = mats[material].diffuse_texname;
+		}
+	}
 
-		for (int v = 0; v < mesh.positions.size(); ++v)
-			verts[v] = mesh.positions[v];
+	std::vector<SBinarySubMesh> layout;
+	storageSize = layoutStorage(subMeshes, layout);
+	storage = new char[storageSize];
+
+	// Interleave the vertices and copy the indices into place
+	for (unsigned long i = 0; i < nShapes; ++i) {
+		const mesh_t& mesh = shapes[i].mesh;
+		SubMesh& subMesh = subMeshes[i];
+		subMesh.vertices = reinterpret_cast<MeshVertex*>(storage + layout[i].vertexOffset);
+		subMesh.indices = reinterpret_cast<int*>(storage + layout[i].indexOffset);
+
+		for (unsigned long v = 0; v < subMesh.numVertices; ++v) {
+			MeshVertex& vertex = subMesh.vertices[v];
+			vertex.position[0] = mesh.positions[3 * v + 0];
+			vertex.position[1] = mesh.positions[3 * v + 1];
+			vertex.position[2] = mesh.positions[3 * v + 2];
+			vertex.uv[0] = subMesh.hasUvs ? mesh.texcoords[2 * v + 0] : 0.0f;
+			vertex.uv[1] = subMesh.hasUvs ? mesh.texcoords[2 * v + 1] : 0.0f;
+		}
 
-		// Extract all edges
-		int *indices = new int[mesh.indices.size()];
+		for (unsigned long ind = 0; ind < subMesh.numIndices; ++ind)
+			subMesh.indices[ind] = mesh.indices[ind];
+	}
 
-		for (int ind = 0; ind < mesh.indices.size(); ++ind)
-			indices[ind] = mesh.indices[ind];
+	return true;
+}
 
-		float *uvs = new float[mesh.texcoords.size()];
-		for (int ind = 0; ind < mesh.texcoords.size(); ++ind)
-			uvs[ind] = mesh.texcoords[ind];
+/**
+ * Map the file and use the storage inside it, checking every sub-mesh lies within it
+ */
+bool MeshInfo::LoadFromBinary(const std::string& binaryFile, uint64_t sourceHash)
+{
+	SMappedAsset file;
+	if (!mapAssetCache(binaryFile, file))
+		return false;
 
-		vertsMap[shapeName] = verts;
-		numVerts[shapeName] = mesh.positions.size();
+	// Check the header and that the tables and storage fit
+	SBinaryMeshHeader header;
+	bool valid = file.size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, file.data, sizeof(header));
+		valid = memcmp(header.magic, BINARY_MESH_MAGIC, 8) == 0 && (sourceHash == 0 || header.sourceHash == sourceHash) &&
+				sizeof(header) + (uint64_t)header.numSubMeshes * sizeof(SBinarySubMesh) <= file.size &&
+				header.stringTableOffset + header.stringTableSize <= file.size &&
+				header.stringTableSize > 0 && file.data[header.stringTableOffset + header.stringTableSize - 1] == '\0' &&
+				header.storageOffset % 16 == 0 && header.storageOffset + header.storageSize <= file.size;
+	}
 
-		indicesMap[shapeName] = indices;
-		numIndices[shapeName] = mesh.indices.size();
+	if (!valid) {
+		unmapAssetCache(file);
+		return false;
+	}
 
-		if(mesh.material_ids[0] >= 0) {
-			MeshTexture *t = loadedTextures[mesh.material_ids[0]];
-			textures[shapeName] = t;
+	const SBinarySubMesh* table = reinterpret_cast<const SBinarySubMesh*>(file.data + sizeof(header));
+	const char* strings = file.data + header.stringTableOffset;
+
+	mapping = file;
+	storage = file.data + header.storageOffset;
+	storageSize = header.storageSize;
+
+	subMeshes.resize(header.numSubMeshes);
+	for (uint32_t i = 0; i < header.numSubMeshes; ++i) {
+		const SBinarySubMesh& entry = table[i];
+		if (entry.vertexOffset % 16 != 0 || entry.indexOffset % 16 != 0 ||
+			entry.vertexOffset + entry.numVertices * sizeof(MeshVertex) > storageSize ||
+			entry.indexOffset + entry.numIndices * sizeof(int) > storageSize ||
+			entry.nameOffset >= header.stringTableSize ||
+			(entry.textureOffset != NO_TEXTURE && entry.textureOffset >= header.stringTableSize)) {
+			ClearData(true);
+			return false;
 		}
 
-		uvsMap[shapeName] = uvs;
+		SubMesh& subMesh = subMeshes[i];
+		subMesh.name = strings + entry.nameOffset;
+		subMesh.vertices = reinterpret_cast<MeshVertex*>(storage + entry.vertexOffset);
+		subMesh.numVertices = entry.numVertices;
+		subMesh.indices = reinterpret_cast<int*>(storage + entry.indexOffset);
+		subMesh.numIndices = entry.numIndices;
+		subMesh.hasUvs = entry.hasUvs != 0;
+
+		if (entry.textureOffset != NO_TEXTURE)
+			subMesh.textureFile = strings + entry.textureOffset;
+	}
+
+	// Textures are relative to the mesh the file was converted from
+	std::string dir = sourceFile.empty() ? binaryFile : sourceFile;
+	dir = dir.substr(0, dir.find_last_of('/') + 1);
 
-		keys.push_back(shapeName);
+	for (auto& subMesh : subMeshes) {
+		if (!subMesh.textureFile.empty())
+			subMesh.texture = getMeshTexture(dir + subMesh.textureFile);
 	}
 
 	return true;
 }
 
 /**
- * Clear the data stored about this texture. Free the memory of associated
- * meshes if freeResources is true
+ * Write the tables followed by a straight copy of the storage
  */
-void MeshInfo::ClearData(bool freeResources)
+bool MeshInfo::SaveToBinary(const std::string& binaryFile, uint64_t sourceHash) const
 {
-	// Clear the resources for all mesh parts
-	for(auto key : keys)
-	{
-		// Free memory if requested
-		if (freeResources)
-		{
-			delete vertsMap[key];
-			delete indicesMap[key];
-		}
-
-		// Clear the data from associated maps
-		vertsMap.erase(key);
-		numVerts.erase(key);
-
-		indicesMap.erase(key);
-		numIndices.erase(key);
+	// Sub-meshes are described by where they sit in the storage
+	std::vector<SBinarySubMesh> table(subMeshes.size());
+	std::string strings;
+	for (size_t i = 0; i < subMeshes.size(); ++i) {
+		const SubMesh& subMesh = subMeshes[i];
+		table[i].vertexOffset = reinterpret_cast<const char*>(subMesh.vertices) - storage;
+		table[i].numVertices = subMesh.numVertices;
+		table[i].indexOffset = reinterpret_cast<const char*>(subMesh.indices) - storage;
+		table[i].numIndices = subMesh.numIndices;
+		table[i].hasUvs = subMesh.hasUvs;
+		table[i].padding = 0;
+
+		table[i].nameOffset = (uint32_t)strings.size();
+		strings.append(subMesh.name).push_back('\0');
+
+		table[i].textureOffset = subMesh.textureFile.empty() ? NO_TEXTURE : (uint32_t)strings.size();
+		if (!subMesh.textureFile.empty())
+			strings.append(subMesh.textureFile).push_back('\0');
 	}
+	strings.push_back('\0');
+
+	SBinaryMeshHeader header;
+	memcpy(header.magic, BINARY_MESH_MAGIC, 8);
+	header.sourceHash = sourceHash;
+	header.numSubMeshes = (uint32_t)subMeshes.size();
+	header.stringTableSize = (uint32_t)strings.size();
+	header.stringTableOffset = sizeof(header) + table.size() * sizeof(SBinarySubMesh);
+	header.storageOffset = alignBlock(header.stringTableOffset + header.stringTableSize);
+	header.storageSize = storageSize;
+
+	// Copy everything into place
+	std::vector<char> data(header.storageOffset + header.storageSize, 0);
+	memcpy(&data[0], &header, sizeof(header));
+	if (!table.empty())
+		memcpy(&data[sizeof(header)], &table[0], table.size() * sizeof(SBinarySubMesh));
+	memcpy(&data[header.stringTableOffset], strings.data(), strings.size());
+	if (storageSize)
+		memcpy(&data[header.storageOffset], storage, storageSize);
+
+	return writeAssetCache(binaryFile, data);
+}
 
-	// We should also deallocate meshes if we are asked to free resources
-	if(freeResources)
-	{
-		// Iterate over all MeshTextures
-		for(auto& pair : textures)
-		{
-			// Free the image data
-			free(pair.second->data);
-
-			// Then delete the MeshTexture object
-			delete(pair.second);
-		}
-
-		// And empty the texture map
-		textures.clear();
+/**
+ * Clear the data stored about this mesh. Free the storage if freeResources is true, textures
+ * belong to the texture cache as other meshes may be using them
+ */
+void MeshInfo::ClearData(bool freeResources)
+{
+	if (freeResources) {
+		// Mapped storage goes along with its mapping
+		if (mapping.data)
+			unmapAssetCache(mapping);
+		else
+			delete[] storage;
 	}
+
+	subMeshes.clear();
+	storage = nullptr;
+	storageSize = 0;
 }
@@ -6,42 +6,113 @@
 #define ARGOS3_BULLET_MESHINFO_H
 
 #include <string>
-#include <map>
 #include <vector>
 
+#include "AssetCache.h"
+
 /**
  * Store data about a single texture. The renderId is provided
- * as a convenience for renderer to store internal texture IDs
+ * as a convenience for renderer to store internal texture IDs.
+ * Textures are shared by every mesh using the same image and are only decoded when asked to.
  */
 struct MeshTexture
 {
-	unsigned int renderId;
-	int width, height;
-	unsigned char* data = nullptr;
+	/**
+	 * Decode the image into RGBA pixels if that hasn't been done yet, returning false if it can't be
+	 */
+	bool Decode();
+
+	/**
+	 * Free the decoded pixels, for instance once the renderer has its own copy. Decode brings them back.
+	 */
+	void ReleaseData();
+
+	std::string file;						// Image the texture is decoded from
+	unsigned int renderId = 0;
+	int width = -1, height = -1;			// Only known once decoded
+	unsigned char* data = nullptr;			// Decoded pixels, null until they are needed
+	bool failed = false;					// Don't retry images which couldn't be decoded
+};
+
+/**
+ * The shared texture for an image file, created on first use but not decoded
+ */
+MeshTexture* getMeshTexture(const std::string& fileName);
+
+/**
+ * One vertex of a mesh. Positions and texture coordinates are interleaved so physics (which strides over
+ * the positions) and rendering (which reads both) share the same array.
+ */
+struct MeshVertex
+{
+	float position[3];
+	float uv[2];						// Zero if the sub-mesh has no texture coordinates
+};
+
+/**
+ * Part of a mesh drawn with a single texture. Its arrays point into the owning mesh's storage.
+ */
+struct SubMesh
+{
+	std::string name;					// Name of the part in the source file
+	MeshVertex* vertices = nullptr;
+	unsigned long numVertices = 0;
+	int* indices = nullptr;				// Three per triangle, into vertices
+	unsigned long numIndices = 0;
+	bool hasUvs = false;				// Are the vertices' texture coordinates meaningful?
+	std::string textureFile;			// Relative to the mesh file, empty if the part isn't textured
+	MeshTexture* texture = nullptr;		// Shared between sub-meshes using the same image
 };
 
 /**
- * A full mesh definition
+ * A full mesh definition. Every sub-mesh's vertices and indices live in one contiguous block, which is
+ * either allocated by the mesh or part of a mapped binary mesh file.
  */
 struct MeshInfo
 {
+	MeshInfo() = default;
+	~MeshInfo() { ClearData(true); }
+
+	MeshInfo(const MeshInfo&) = delete;
+	MeshInfo& operator=(const MeshInfo&) = delete;
+
 	/**
-	 * Clear out all maps and (optionally) deallocate associated arrays
+	 * Forget all sub-meshes and (optionally) release the storage and textures they use
 	 */
 	void ClearData(bool freeResources);
 
 	/**
-	 * Load a mesh from the specified file
+	 * Load a mesh from the specified file. OBJ files are converted to the binary mesh format in the
+	 * asset cache the first time they are loaded and mapped from there afterwards.
 	 */
 	bool LoadFromFile(std::string sourceFile);
 
-	std::vector<std::string> keys;						// A mesh map have several sub-meshes
-	std::map<std::string, float*> vertsMap;				// Vertex array of each sub-mesh
-	std::map<std::string, float*> uvsMap;				// Texture coordinates of each sub-mesh
-	std::map<std::string, MeshTexture*> textures;		// Texture info of each sub-mesh
-	std::map<std::string, unsigned long> numVerts;		// How many vertices in each sub-mesh?
-	std::map<std::string, int*> indicesMap;				// What are the order of vertices to be draw in each sub-mesh
-	std::map<std::string, unsigned long> numIndices;	// How many sets of indices are in this mesh
+	/**
+	 * Can LoadFromFile load the given file? Files are recognised by their extension, OBJ or binary mesh.
+	 */
+	static bool IsLoadable(const std::string& fileName);
+
+	/**
+	 * Parse an OBJ file and its materials into freshly allocated storage, bypassing the binary format
+	 */
+	bool LoadFromObj(const std::string& objFile);
+
+	/**
+	 * Load a mesh saved by SaveToBinary. The storage is the mapped file itself rather than a copy.
+	 * If sourceHash is non-zero it must match the hash the file was saved with.
+	 */
+	bool LoadFromBinary(const std::string& binaryFile, uint64_t sourceHash = 0);
+
+	/**
+	 * Save the mesh in the binary format, tagged with the hash of the file it came from (or 0)
+	 */
+	bool SaveToBinary(const std::string& binaryFile, uint64_t sourceHash) const;
+
+	std::string sourceFile;					// Where the mesh was loaded from
+	std::vector<SubMesh> subMeshes;			// A mesh may have several sub-meshes
+	char* storage = nullptr;				// Vertices and indices of every sub-mesh
+	size_t storageSize = 0;
+	SMappedAsset mapping;					// Binary mesh file the storage lives in, empty if it was allocated
 };
 
 #endif //ARGOS3_BULLET_MESHINFO_H
@@ -10,6 +10,8 @@
 #include <vector>
 #include <argos3/core/simulator/simulator.h>
 
+struct ConvexDecomposition;
+
 /**
  * Material properties
  * Contains all physical attributes (non-visual)
@@ -203,6 +205,7 @@ struct MeshAttributes
 {
 	MeshInfo* mesh;
 	float sx, sy, sz;
+	ConvexDecomposition* decomposition;		// Convex parts to collide with, null unless asked for
 };
 
 /**
@@ -6,6 +6,8 @@
 #include <set>
 
 #include "MultibodyEntityDatabase.h"
+#include "ConvexDecomposition.h"
+#include "AssetLoader.h"
 
 #include "StringFuncs.h"
 
@@ -19,12 +21,63 @@ MultibodyEntityDatabase &MultibodyEntityDatabase::getInstance()
 
 MultibodyDefinition* MultibodyEntityDatabase::getModel(std::string fileName)
 {
-	// Load the model if we haven't already
-	if(loadedModels.find(fileName)==loadedModels.end())
-		loadedModels[fileName] = new MultibodyDefinition{fileName};
+	// Load the model if nobody has started to already
+	SLoadingModel* entry;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entry = &startLoading(fileName);
+	}
+
+	// Wait for whoever is loading it, map entries never move so the entry stays valid
+	AssetLoader::GetInstance().Wait(entry->loaded);
 
 	// Return a pointer to the model
-	return loadedModels[fileName];
+	return entry->model;
+}
+
+void MultibodyEntityDatabase::prefetch(const std::string& fileName)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	startLoading(fileName);
+}
+
+/*
+ * Walk the whole XML tree looking for assets entities will ask for
+ */
+void MultibodyEntityDatabase::prefetchAll(ticpp::Element* element)
+{
+	Element* child = element->FirstChildElement(false);
+	while(child)
+	{
+		if(child->HasAttribute("definition_file"))
+			prefetch(child->GetAttribute("definition_file"));
+
+		if(child->HasAttribute("mesh_file"))
+		{
+			std::shared_future<void> loaded;
+			MultibodyDefinition::LoadMeshAsync(child->GetAttribute("mesh_file"), loaded);
+		}
+
+		prefetchAll(child);
+		child = child->NextSiblingElement(false);
+	}
+}
+
+/*
+ * Queue a definition's load unless it is already known, the caller must hold the lock
+ */
+MultibodyEntityDatabase::SLoadingModel& MultibodyEntityDatabase::startLoading(const std::string& fileName)
+{
+	auto it = loadedModels.find(fileName);
+	if(it != loadedModels.end())
+		return it->second;
+
+	SLoadingModel& entry = loadedModels[fileName];
+	entry.model = nullptr;
+	entry.loaded = AssetLoader::GetInstance().Submit([&entry, fileName] {
+		entry.model = new MultibodyDefinition{fileName};
+	});
+	return entry;
 }
 
 MultibodyDefinition::MultibodyDefinition(std::string fileName)
@@ -68,6 +121,11 @@ MultibodyDefinition::MultibodyDefinition(std::string fileName)
 		auto& parentLink = links[joint.parent];
 		childLink.parent = &parentLink;
 	}
+
+	// Meshes (and anything built from them) have been loading in the background while we parsed
+	for(auto& load : pendingLoads)
+		AssetLoader::GetInstance().Wait(load);
+	pendingLoads.clear();
 }
 
 /*
@@ -554,38 +612,61 @@ void MultibodyDefinition::handleVisualOrCollision(ticpp::Element *definitionElem
 				exit(1);
 			}
 
-			// Check if this mesh has already been loaded
 			std::string meshFileName = shapeDefinition->GetAttribute("filename");
 
-			// If not we need to load it
-			if(meshIndices.find(meshFileName) == meshIndices.end())
+			// Start loading it unless it's already in memory
+			std::shared_future<void> meshLoaded;
+			spec.mesh.mesh = LoadMeshAsync(meshFileName, meshLoaded);
+			if(!spec.mesh.mesh)
 			{
-				// Check if we can handle it
-				// Since many formats are text based we will use file extensions to determine type
-				if(endsWith(meshFileName, ".obj"))
-				{
-					// If we can then we should load it, record its location, and add its definition
-					MeshInfo* info = new MeshInfo;
-					info->LoadFromFile(meshFileName);
-					meshIndices[meshFileName] = (int)meshes.size();
-					meshes.push_back(info);
-				}
-				else
-				{
-					// We can't handle this yet, report an error
-					std::cerr << "Unsupported mesh file (" << meshFileName <<
-					") when parsing definition of entity (" << name <<
-					" in file " << fileName << ")" << std::endl;
-					exit(1);
-				}
+				// We can't handle this yet, report an error
+				std::cerr << "Unsupported mesh file (" << meshFileName <<
+				") when parsing definition of entity (" << name <<
+				" in file " << fileName << ")" << std::endl;
+				exit(1);
 			}
 
-			//The mesh is now guaranteed to be in memory so get its index
-			spec.mesh.mesh = meshes[meshIndices[meshFileName]];
-
 			// Extract a scale if one is provided
 			extractFromString(shapeDefinition->GetAttributeOrDefault("scale", "1 1 1"), spec.mesh.sx, spec.mesh.sy,
 							  spec.mesh.sz);
+
+			// Concave collision meshes can be split into a few convex hulls up front
+			spec.mesh.decomposition = nullptr;
+			if(!asVisual && shapeDefinition->GetAttributeOrDefault("decompose", "false") == "true")
+			{
+				int maxHulls, maxVertices;
+				extractFromString(shapeDefinition->GetAttributeOrDefault("max_hulls", "16"), maxHulls);
+				extractFromString(shapeDefinition->GetAttributeOrDefault("hull_vertices", "32"), maxVertices);
+				if(maxHulls < 1 || maxVertices < 4)
+				{
+					std::cerr << "Mesh decomposition needs at least 1 hull of 4 vertices when parsing definition of entity (" <<
+					name << " in file " << fileName << ")" << std::endl;
+					exit(1);
+				}
+
+				// Decompositions are shared by every entity using the same mesh, scale and limits
+				std::ostringstream decompositionKey;
+				decompositionKey << meshFileName << " " << spec.mesh.sx << " " << spec.mesh.sy << " " << spec.mesh.sz <<
+				" " << maxHulls << " " << maxVertices;
+
+				std::lock_guard<std::mutex> lock(assetMutex);
+				ConvexDecomposition*& decomposition = decompositions[decompositionKey.str()];
+				if(!decomposition)
+				{
+					// Decompose once the mesh is in, queued when its load ends rather than waiting on it in the loader
+					decomposition = new ConvexDecomposition;
+					ConvexDecomposition* target = decomposition;
+					MeshInfo* mesh = spec.mesh.mesh;
+					btVector3 scale{spec.mesh.sx, spec.mesh.sy, spec.mesh.sz};
+					decompositionLoads[decompositionKey.str()] = AssetLoader::GetInstance().SubmitAfter(meshLoaded, [=] {
+						meshLoaded.get();
+						decomposeMesh(*mesh, scale, maxHulls, maxVertices, *target);
+					});
+				}
+				spec.mesh.decomposition = decomposition;
+				pendingLoads.push_back(decompositionLoads[decompositionKey.str()]);
+			}
+			pendingLoads.push_back(meshLoaded);
 			break;
 		}
 	}
@@ -633,8 +714,54 @@ void MultibodyDefinition::handleVisualOrCollision(ticpp::Element *definitionElem
 	materialStack.popLevel();
 }
 
+/*
+ * Load a mesh the first time it is asked for and share it from then on
+ */
+MeshInfo* MultibodyDefinition::LoadMesh(const std::string& meshFileName)
+{
+	std::shared_future<void> loaded;
+	MeshInfo* info = LoadMeshAsync(meshFileName, loaded);
+	if(info)
+		AssetLoader::GetInstance().Wait(loaded);
+	return info;
+}
+
+/*
+ * Queue a mesh (and its textures) for loading the first time it is asked for
+ */
+MeshInfo* MultibodyDefinition::LoadMeshAsync(const std::string& meshFileName, std::shared_future<void>& loaded)
+{
+	std::lock_guard<std::mutex> lock(assetMutex);
+
+	// Check if this mesh has already been loaded, or is being loaded
+	auto it = meshIndices.find(meshFileName);
+	if(it != meshIndices.end())
+	{
+		loaded = meshLoads[it->second];
+		return meshes[it->second];
+	}
+
+	// Check if we can handle it, the mesh itself knows which formats it reads
+	if(!MeshInfo::IsLoadable(meshFileName))
+		return nullptr;
+
+	// If we can then we should load it, record its location, and add its definition
+	MeshInfo* info = new MeshInfo;
+	loaded = AssetLoader::GetInstance().Submit([info, meshFileName] {
+		info->LoadFromFile(meshFileName);
+	});
+	meshIndices[meshFileName] = (int)meshes.size();
+	meshes.push_back(info);
+	meshLoads.push_back(loaded);
+	return info;
+}
+
 /*
  * Static definitions
  */
+std::mutex MultibodyDefinition::assetMutex;
 std::vector<MeshInfo*> MultibodyDefinition::meshes;
 std::map<std::string, int> MultibodyDefinition::meshIndices;
+std::vector<std::shared_future<void>> MultibodyDefinition::meshLoads;
+std::map<std::string, ConvexDecomposition*> MultibodyDefinition::decompositions;
+std::map<std::string, std::shared_future<void>> MultibodyDefinition::decompositionLoads;
@@ -9,6 +9,7 @@
 #include <map>
 #include <vector>
 #include <mutex>
+#include <future>
 
 #include "MultibodyDefinitions.h"
 
@@ -76,13 +77,33 @@ public:
 	 */
 	static MeshInfo& GetMeshInfo(int meshIdx)
 	{
+		std::lock_guard<std::mutex> lock(assetMutex);
 		return *meshes[meshIdx];
 	}
 
+	/**
+	 * Returns the mesh in the given file, loading it the first time it is asked for.
+	 * Null if the file's format isn't supported.
+	 */
+	static MeshInfo* LoadMesh(const std::string& meshFileName);
+
+	/**
+	 * As LoadMesh but returns straight away, the mesh may only be used once loaded is ready.
+	 * Any number of callers can wait on the same load.
+	 */
+	static MeshInfo* LoadMeshAsync(const std::string& meshFileName, std::shared_future<void>& loaded);
+
 
 private:
+	static std::mutex assetMutex;										// Guards all the shared assets below
 	static std::vector<MeshInfo*> meshes;
 	static std::map<std::string, int> meshIndices;
+	static std::vector<std::shared_future<void>> meshLoads;				// In the same order as meshes
+	static std::map<std::string, ConvexDecomposition*> decompositions;
+	static std::map<std::string, std::shared_future<void>> decompositionLoads;
+
+	// Loads this definition has started and must wait for before it can be used
+	std::vector<std::shared_future<void>> pendingLoads;
 
 	std::map<std::string, Link> links;
     std::map<std::string, JointDefinition> joints;
@@ -133,9 +154,36 @@ class MultibodyEntityDatabase
 {
 public:
 	static MultibodyEntityDatabase & getInstance();
+
+	/**
+	 * Returns the definition in the given file, loading it (or waiting for a load already started) first.
+	 * Safe to call from any thread.
+	 */
 	MultibodyDefinition* getModel(std::string fileName);
+
+	/**
+	 * Start loading a definition in the background so a later getModel doesn't have to wait as long
+	 */
+	void prefetch(const std::string& fileName);
+
+	/**
+	 * Prefetch every definition file and static mesh mentioned anywhere under an ARGoS XML node
+	 */
+	void prefetchAll(ticpp::Element* element);
 private:
-	std::map<std::string, MultibodyDefinition*> loadedModels;
+	/**
+	 * A definition which may still be loading
+	 */
+	struct SLoadingModel
+	{
+		MultibodyDefinition* model;
+		std::shared_future<void> loaded;
+	};
+
+	SLoadingModel& startLoading(const std::string& fileName);
+
+	std::mutex mutex;										// Guards loadedModels
+	std::map<std::string, SLoadingModel> loadedModels;
 };
 
 
@@ -0,0 +1,158 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "StaticMeshBvh.h"
+
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+/**
+ * Start of a BVH cache file. The BVH is stored in bullet's in-place format which depends on the
+ * scalar and pointer sizes it was built with, so those have to match as well as the mesh.
+ */
+struct SBvhCacheHeader
+{
+	char magic[8];
+	uint64_t meshHash;
+	uint32_t scalarSize;
+	uint32_t pointerSize;
+	uint32_t dataSize;
+	uint32_t padding;			// Keeps the BVH data that follows 16 byte aligned
+};
+
+static_assert(sizeof(SBvhCacheHeader) % 16 == 0, "BVH cache data must stay 16 byte aligned");
+
+/**
+ * Identifies a BVH cache file, bump the version if the format changes
+ */
+static const char BVH_CACHE_MAGIC[8] = {'B', 'F', 'A', 'B', 'V', 'H', '0', '1'};
+
+/**
+ * Wrap the sub-meshes for bullet then find a BVH for them, from the cache if the mesh came from a file
+ */
+CStaticMeshBvh::CStaticMeshBvh(const MeshInfo& mesh, const btVector3& scale) : bvh(nullptr)
+{
+	triangles = new btTriangleIndexVertexArray;
+	for(auto& subMesh : mesh.subMeshes)
+	{
+		btIndexedMesh part;
+		part.m_numTriangles = (int)subMesh.numIndices / 3;
+		part.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(subMesh.indices);
+		part.m_triangleIndexStride = 3 * sizeof(int);
+		part.m_numVertices = (int)subMesh.numVertices;
+		part.m_vertexBase = reinterpret_cast<const unsigned char*>(subMesh.vertices);
+		part.m_vertexStride = sizeof(MeshVertex);
+		part.m_vertexType = PHY_FLOAT;
+		triangles->addIndexedMesh(part, PHY_INTEGER);
+	}
+
+	// The BVH is built around the scaled triangles so the shape itself never needs scaling
+	triangles->setScaling(scale);
+
+	if(mesh.sourceFile.empty())
+	{
+		BuildBvh();
+		return;
+	}
+
+	std::ostringstream tag;
+	tag << std::setprecision(9) << "bvh_" << scale.x() << "_" << scale.y() << "_" << scale.z();
+	std::string cacheFile = assetCachePath(mesh.sourceFile, tag.str());
+	uint64_t meshHash = hashFile(mesh.sourceFile);
+
+	if(LoadBvh(cacheFile, meshHash))
+		return;
+
+	BuildBvh();
+	SaveBvh(cacheFile, meshHash);
+}
+
+/**
+ * A mapped BVH doesn't own any memory of its own, one we built has to be destroyed
+ */
+CStaticMeshBvh::~CStaticMeshBvh()
+{
+	if(mapping.data)
+		unmapAssetCache(mapping);
+	else if(bvh)
+	{
+		bvh->~btOptimizedBvh();
+		btAlignedFree(bvh);
+	}
+
+	delete triangles;
+}
+
+/**
+ * Map the cache file and fix up the BVH inside it without copying anything
+ */
+bool CStaticMeshBvh::LoadBvh(const std::string& cacheFile, uint64_t meshHash)
+{
+	if(!mapAssetCache(cacheFile, mapping))
+		return false;
+
+	SBvhCacheHeader header;
+	bool valid = mapping.size > sizeof(header);
+	if(valid)
+	{
+		memcpy(&header, mapping.data, sizeof(header));
+		valid = memcmp(header.magic, BVH_CACHE_MAGIC, 8) == 0 && header.meshHash == meshHash &&
+				header.scalarSize == sizeof(btScalar) && header.pointerSize == sizeof(void*) &&
+				header.dataSize == mapping.size - sizeof(header);
+	}
+
+	btQuantizedBvh* loaded = nullptr;
+	if(valid)
+		loaded = btQuantizedBvh::deSerializeInPlace(mapping.data + sizeof(header), header.dataSize, false);
+
+	if(!loaded)
+	{
+		unmapAssetCache(mapping);
+		return false;
+	}
+
+	// btOptimizedBvh only adds build and refit methods, bullet's own samples reuse serialized BVHs the same way
+	bvh = static_cast<btOptimizedBvh*>(loaded);
+	return true;
+}
+
+/**
+ * Build a quantized BVH the same way btBvhTriangleMeshShape would
+ */
+void CStaticMeshBvh::BuildBvh()
+{
+	btVector3 aabbMin, aabbMax;
+	triangles->calculateAabbBruteForce(aabbMin, aabbMax);
+
+	void* memory = btAlignedAlloc(sizeof(btOptimizedBvh), 16);
+	bvh = new (memory) btOptimizedBvh();
+	bvh->build(triangles, true, aabbMin, aabbMax);
+}
+
+/**
+ * Serialize the BVH in place behind a header describing where it came from
+ */
+void CStaticMeshBvh::SaveBvh(const std::string& cacheFile, uint64_t meshHash) const
+{
+	SBvhCacheHeader header;
+	memcpy(header.magic, BVH_CACHE_MAGIC, 8);
+	header.meshHash = meshHash;
+	header.scalarSize = sizeof(btScalar);
+	header.pointerSize = sizeof(void*);
+	header.dataSize = bvh->calculateSerializeBufferSize();
+	header.padding = 0;
+
+	// Serializing needs an aligned buffer so it can't go straight into the cache data
+	void* buffer = btAlignedAlloc(header.dataSize, 16);
+	if(bvh->serialize(buffer, header.dataSize, false))
+	{
+		std::vector<char> data;
+		appendToCache(data, &header, 1);
+		appendToCache(data, static_cast<char*>(buffer), header.dataSize);
+		writeAssetCache(cacheFile, data);
+	}
+	btAlignedFree(buffer);
+}
@@ -0,0 +1,40 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_STATICMESHBVH_H
+#define ARGOS3_BULLET_STATICMESHBVH_H
+
+#include "./bullet/src/btBulletCollisionCommon.h"
+#include "./bullet/src/BulletCollision/CollisionShapes/btOptimizedBvh.h"
+#include "AssetCache.h"
+#include "MeshInfo.h"
+
+/**
+ * Triangles of a mesh at a fixed scale along with their quantized BVH, ready for btBvhTriangleMeshShape.
+ * The BVH is mapped straight from the asset cache when possible, otherwise it is built and saved there
+ * so later runs can skip building it entirely.
+ */
+class CStaticMeshBvh
+{
+public:
+	CStaticMeshBvh(const MeshInfo& mesh, const btVector3& scale);
+	~CStaticMeshBvh();
+
+	CStaticMeshBvh(const CStaticMeshBvh&) = delete;
+	CStaticMeshBvh& operator=(const CStaticMeshBvh&) = delete;
+
+	btTriangleIndexVertexArray* GetTriangles() const { return triangles; }
+	btOptimizedBvh* GetBvh() const { return bvh; }
+
+private:
+	bool LoadBvh(const std::string& cacheFile, uint64_t meshHash);
+	void BuildBvh();
+	void SaveBvh(const std::string& cacheFile, uint64_t meshHash) const;
+
+	btTriangleIndexVertexArray* triangles;		// Every sub-mesh, scaled
+	btOptimizedBvh* bvh;						// Either inside the mapping or built by us
+	SMappedAsset mapping;						// Cache file the BVH lives in, empty if it was built
+};
+
+#endif //ARGOS3_BULLET_STATICMESHBVH_H
@@ -0,0 +1,107 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "WorkerPool.h"
+
+/**
+ * Start the worker threads, the calling thread makes up the final one
+ */
+WorkerPool::WorkerPool(unsigned int numThreads)
+{
+	if(numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+
+	for(unsigned int i = 1; i < numThreads; ++i)
+		workers.emplace_back(&WorkerPool::WorkerLoop, this, i);
+}
+
+/**
+ * Ask all workers to exit and wait for them
+ */
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for(auto& worker : workers)
+		worker.join();
+}
+
+/**
+ * Hand out indices to the workers and the calling thread until none remain
+ */
+void WorkerPool::ParallelFor(int count, const TTask& task)
+{
+	if(count <= 0)
+		return;
+
+	// Not worth waking anyone up, or they are already busy
+	bool idle = false;
+	if(workers.empty() || count == 1 || !running.compare_exchange_strong(idle, true))
+	{
+		for(int i = 0; i < count; ++i)
+			task(i, 0);
+		return;
+	}
+
+	// Publish the new batch
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentTask = &task;
+		taskCount = count;
+		nextIndex = 0;
+		busyWorkers = (unsigned int)workers.size();
+		++generation;
+	}
+	wakeCondition.notify_all();
+
+	// Help out
+	RunTasks(0);
+
+	// And wait for the stragglers
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this]{ return busyWorkers == 0; });
+	currentTask = nullptr;
+	running = false;
+}
+
+/**
+ * Claim indices from the shared counter until the batch is exhausted
+ */
+void WorkerPool::RunTasks(unsigned int threadIndex)
+{
+	int index;
+	while((index = nextIndex++) < taskCount)
+		(*currentTask)(index, threadIndex);
+}
+
+/**
+ * Sleep until a new batch is published, run it and report back
+ */
+void WorkerPool::WorkerLoop(unsigned int threadIndex)
+{
+	unsigned long seenGeneration = 0;
+
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&]{ return stopping || generation != seenGeneration; });
+			if(stopping)
+				return;
+			seenGeneration = generation;
+		}
+
+		RunTasks(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(--busyWorkers == 0)
+				doneCondition.notify_one();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_WORKERPOOL_H
+#define ARGOS3_BULLET_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed size pool of worker threads used to spread independent pieces of work
+ * (islands, collision pairs, rays...) over the available cores. The thread calling
+ * ParallelFor takes part in the work as thread 0 so a pool of N threads only
+ * creates N-1 workers.
+ */
+class WorkerPool
+{
+public:
+	// Task signature, receives the item index and the index of the thread running it
+	using TTask = std::function<void(int index, unsigned int threadIndex)>;
+
+	/**
+	 * Create a pool with the given number of threads, 0 uses one per hardware core
+	 */
+	explicit WorkerPool(unsigned int numThreads = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/**
+	 * Total number of threads work is spread over, including the caller
+	 */
+	unsigned int GetNumThreads() const { return (unsigned int)workers.size() + 1; }
+
+	/**
+	 * Run task for every index in [0, count) and return once all have completed.
+	 * If the pool is already running a batch (a call from inside a task or from another
+	 * thread) the work is done serially on the calling thread, reported as thread 0.
+	 */
+	void ParallelFor(int count, const TTask& task);
+
+private:
+	void WorkerLoop(unsigned int threadIndex);
+	void RunTasks(unsigned int threadIndex);
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;		// Signalled when a new batch is ready
+	std::condition_variable doneCondition;		// Signalled when the last worker finishes a batch
+
+	const TTask* currentTask{nullptr};
+	int taskCount{0};
+	std::atomic<int> nextIndex{0};
+	unsigned long generation{0};				// Incremented for every batch so workers never run one twice
+	unsigned int busyWorkers{0};
+	bool stopping{false};
+	std::atomic<bool> running{false};			// Set while a batch is in flight
+};
+
+#endif //ARGOS3_BULLET_WORKERPOOL_H
@@ -0,0 +1,370 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include "WorldCheckpoint.h"
+#include "AssetCache.h"
+#include "CWorldSnapshot.h"
+#include "BulletDynamics/Featherstone/btMultiBody.h"
+#include "BulletDynamics/Featherstone/btMultiBodyDynamicsWorld.h"
+#include "LinearMath/btSerializer.h"
+
+#include <cstring>
+
+/**
+ * Start of a checkpoint file, followed by each section in turn. Sections are padded to 16 bytes so the multibody
+ * values can be read straight out of the mapping.
+ */
+struct SCheckpointHeader
+{
+	char magic[8];
+	uint32_t scalarSize;
+	uint32_t pointerSize;
+	uint64_t simulationClock;
+	uint64_t bulletSize;		// Rigid bodies and constraints, as a file from bullet's serializer
+	uint64_t multiBodySize;		// Base state then joint values of each btMultiBody
+	uint64_t modelSize;			// Model ids with the extra values they asked for
+};
+
+static_assert(sizeof(SCheckpointHeader) % 16 == 0, "Checkpoint sections must stay 16 byte aligned");
+
+/**
+ * Identifies a checkpoint file, bump the version if the format changes
+ */
+static const char CHECKPOINT_MAGIC[8] = {'B', 'F', 'A', 'C', 'K', 'P', '0', '1'};
+
+/**
+ * Base origin, rotation, linear and angular velocity then whether it is awake, before each btMultiBody's joints
+ */
+static const int MULTIBODY_BASE_VALUES = 14;
+
+/**
+ * Pad a section out to the alignment the next one needs
+ */
+static void padSection(std::vector<char>& data)
+{
+	data.resize((data.size() + 15) & ~(size_t)15, 0);
+}
+
+/**
+ * Bounds checked reads from a mapped checkpoint, running off the end means the file is damaged
+ */
+struct SCheckpointReader
+{
+	const char* data;
+	size_t size;
+	size_t offset;
+
+	template<typename T>
+	void Read(T* values, size_t count)
+	{
+		if(count > (size - offset) / sizeof(T))
+			THROW_ARGOSEXCEPTION("Checkpoint is truncated");
+
+		memcpy(values, data + offset, count * sizeof(T));
+		offset += count * sizeof(T);
+	}
+};
+
+/**
+ * Serialize every rigid body and constraint the way btDiscreteDynamicsWorld::serialize does, but without the
+ * shapes which can be far bigger than the state (BVHs...) and never change
+ */
+static void writeBulletSection(btDynamicsWorld& world, std::vector<char>& data)
+{
+	btDefaultSerializer serializer;
+	serializer.startSerialization();
+
+	btCollisionObjectArray& objects = world.getCollisionObjectArray();
+	for(int i = 0; i < objects.size(); ++i)
+	{
+		btCollisionObject* object = objects[i];
+		if(object->getInternalType() != btCollisionObject::CO_RIGID_BODY)
+			continue;
+
+		btChunk* chunk = serializer.allocate(object->calculateSerializeBufferSize(), 1);
+		const char* structType = object->serialize(chunk->m_oldPtr, &serializer);
+		serializer.finalizeChunk(chunk, structType, BT_RIGIDBODY_CODE, object);
+	}
+
+	for(int i = 0; i < world.getNumConstraints(); ++i)
+	{
+		btTypedConstraint* constraint = world.getConstraint(i);
+		btChunk* chunk = serializer.allocate(constraint->calculateSerializeBufferSize(), 1);
+		const char* structType = constraint->serialize(chunk->m_oldPtr, &serializer);
+		serializer.finalizeChunk(chunk, structType, BT_CONSTRAINT_CODE, constraint);
+	}
+
+	serializer.finishSerialization();
+	appendToCache(data, serializer.getBufferPointer(), (size_t)serializer.getCurrentBufferSize());
+}
+
+/**
+ * Pick the rigid bodies and constraints back out of a serialized file. Every constraint's data starts with the
+ * same typed constraint struct so only that part is kept.
+ */
+static void readBulletSection(const char* data, size_t size, std::vector<btRigidBodyData>& bodies,
+							  std::vector<btTypedConstraintData2>& constraints)
+{
+	if(size < BT_HEADER_LENGTH || memcmp(data, "BULLET", 6) != 0)
+		THROW_ARGOSEXCEPTION("Checkpoint has no bullet data");
+
+	SCheckpointReader reader{data, size, BT_HEADER_LENGTH};
+	while(reader.offset < size)
+	{
+		btChunk chunk;
+		reader.Read(&chunk, 1);
+		if(chunk.m_length < 0 || (size_t)chunk.m_length > size - reader.offset)
+			THROW_ARGOSEXCEPTION("Checkpoint is truncated");
+
+		if(chunk.m_chunkCode == BT_RIGIDBODY_CODE && (size_t)chunk.m_length >= sizeof(btRigidBodyData))
+		{
+			bodies.emplace_back();
+			memcpy(&bodies.back(), data + reader.offset, sizeof(btRigidBodyData));
+		}
+		else if(chunk.m_chunkCode == BT_CONSTRAINT_CODE && (size_t)chunk.m_length >= sizeof(btTypedConstraintData2))
+		{
+			constraints.emplace_back();
+			memcpy(&constraints.back(), data + reader.offset, sizeof(btTypedConstraintData2));
+		}
+
+		reader.offset += chunk.m_length;
+	}
+}
+
+/**
+ * Joint values for every btMultiBody, which bullet can't serialize
+ */
+static void writeMultiBodySection(btMultiBodyDynamicsWorld* multiBodyWorld, std::vector<char>& data)
+{
+	std::vector<btScalar> values;
+	for(int i = 0; multiBodyWorld && i < multiBodyWorld->getNumMultibodies(); ++i)
+	{
+		btMultiBody* multiBody = multiBodyWorld->getMultiBody(i);
+		const btTransform& base = multiBody->getBaseWorldTransform();
+		btQuaternion rotation = base.getRotation();
+		btScalar baseValues[MULTIBODY_BASE_VALUES] = {
+				base.getOrigin().x(), base.getOrigin().y(), base.getOrigin().z(),
+				rotation.x(), rotation.y(), rotation.z(), rotation.w(),
+				multiBody->getBaseVel().x(), multiBody->getBaseVel().y(), multiBody->getBaseVel().z(),
+				multiBody->getBaseOmega().x(), multiBody->getBaseOmega().y(), multiBody->getBaseOmega().z(),
+				(btScalar)(multiBody->isAwake() ? 1 : 0)};
+
+		values.insert(values.end(), baseValues, baseValues + MULTIBODY_BASE_VALUES);
+		CWorldSnapshot::CaptureMultiBody(*multiBody, values);
+	}
+
+	appendToCache(data, values.data(), values.size());
+}
+
+/**
+ * Number of values writeMultiBodySection writes for the world as it is now
+ */
+static size_t countMultiBodyValues(btMultiBodyDynamicsWorld* multiBodyWorld)
+{
+	size_t count = 0;
+	for(int i = 0; multiBodyWorld && i < multiBodyWorld->getNumMultibodies(); ++i)
+	{
+		btMultiBody* multiBody = multiBodyWorld->getMultiBody(i);
+		count += MULTIBODY_BASE_VALUES;
+		for(int link = 0; link < multiBody->getNumLinks(); ++link)
+			count += multiBody->getLink(link).m_posVarCount + multiBody->getLink(link).m_dofCount;
+	}
+
+	return count;
+}
+
+/**
+ * Each model with extra state as its id, the number of values then the values
+ */
+static void writeModelSection(const CBulletEngine::TMap& models, std::vector<char>& data)
+{
+	std::vector<float> values;
+	for(auto& entry : models)
+	{
+		values.clear();
+		entry.second->WriteCheckpoint(values);
+		if(values.empty())
+			continue;
+
+		uint32_t idLength = (uint32_t)entry.first.size();
+		uint32_t count = (uint32_t)values.size();
+		appendToCache(data, &idLength, 1);
+		appendToCache(data, entry.first.data(), idLength);
+		appendToCache(data, &count, 1);
+		appendToCache(data, values.data(), count);
+	}
+}
+
+/**
+ * Build the whole file in memory then swap it into place
+ */
+bool writeCheckpoint(const std::string& file, btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld,
+					 const CBulletEngine::TMap& models, uint32_t simulationClock)
+{
+	SCheckpointHeader header;
+	memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+	header.scalarSize = sizeof(btScalar);
+	header.pointerSize = sizeof(void*);
+	header.simulationClock = simulationClock;
+
+	std::vector<char> data(sizeof(header));
+
+	writeBulletSection(world, data);
+	padSection(data);
+	header.bulletSize = data.size() - sizeof(header);
+
+	writeMultiBodySection(multiBodyWorld, data);
+	padSection(data);
+	header.multiBodySize = data.size() - sizeof(header) - header.bulletSize;
+
+	writeModelSection(models, data);
+	header.modelSize = data.size() - sizeof(header) - header.bulletSize - header.multiBodySize;
+
+	memcpy(data.data(), &header, sizeof(header));
+	return writeAssetCache(file, data);
+}
+
+/**
+ * Check the whole checkpoint matches the world before changing anything, so a mismatched file leaves the world as
+ * it was, then apply it
+ */
+static void applyCheckpoint(const char* data, size_t size, btDynamicsWorld& world,
+							btMultiBodyDynamicsWorld* multiBodyWorld, const CBulletEngine::TMap& models,
+							uint32_t& simulationClock)
+{
+	SCheckpointHeader header;
+	if(size < sizeof(header))
+		THROW_ARGOSEXCEPTION("Checkpoint is truncated");
+
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0)
+		THROW_ARGOSEXCEPTION("Not a bullet checkpoint");
+	if(header.scalarSize != sizeof(btScalar) || header.pointerSize != sizeof(void*))
+		THROW_ARGOSEXCEPTION("Checkpoint was written by a build with a different precision or pointer size");
+	if(header.bulletSize + header.multiBodySize + header.modelSize != size - sizeof(header))
+		THROW_ARGOSEXCEPTION("Checkpoint is truncated");
+
+	const char* bulletData = data + sizeof(header);
+	const char* multiBodyData = bulletData + header.bulletSize;
+	const char* modelData = multiBodyData + header.multiBodySize;
+
+	// Bodies and constraints are matched up by the order the experiment created them in
+	std::vector<btRigidBodyData> bodyData;
+	std::vector<btTypedConstraintData2> constraintData;
+	readBulletSection(bulletData, header.bulletSize, bodyData, constraintData);
+
+	std::vector<btRigidBody*> bodies;
+	btCollisionObjectArray& objects = world.getCollisionObjectArray();
+	for(int i = 0; i < objects.size(); ++i)
+	{
+		if(objects[i]->getInternalType() == btCollisionObject::CO_RIGID_BODY)
+			bodies.push_back(btRigidBody::upcast(objects[i]));
+	}
+
+	if(bodies.size() != bodyData.size() || (int)constraintData.size() != world.getNumConstraints())
+		THROW_ARGOSEXCEPTION("Checkpoint has " << bodyData.size() << " bodies and " << constraintData.size()
+							 << " constraints, the experiment has " << bodies.size() << " and " << world.getNumConstraints());
+
+	for(size_t i = 0; i < bodies.size(); ++i)
+	{
+		if(bodyData[i].m_inverseMass != bodies[i]->getInvMass())
+			THROW_ARGOSEXCEPTION("Checkpoint body " << i << " has a different mass to the experiment's");
+	}
+
+	// Multibodies are only checked by their total number of joint values
+	size_t multiBodyCount = countMultiBodyValues(multiBodyWorld);
+	if(header.multiBodySize < multiBodyCount * sizeof(btScalar) || header.multiBodySize - multiBodyCount * sizeof(btScalar) >= 16)
+		THROW_ARGOSEXCEPTION("Checkpoint multibodies don't match the experiment's");
+
+	// Models must exist and want the same number of values they wrote
+	std::vector<std::pair<CBulletModel*, std::vector<float>>> modelStates;
+	SCheckpointReader reader{modelData, header.modelSize, 0};
+	std::vector<float> expected;
+	while(reader.offset < reader.size)
+	{
+		uint32_t idLength, count;
+		reader.Read(&idLength, 1);
+		std::string id(idLength, '\0');
+		reader.Read(&id[0], idLength);
+		reader.Read(&count, 1);
+
+		auto it = models.find(id);
+		if(it == models.end())
+			THROW_ARGOSEXCEPTION("Checkpoint has state for \"" << id << "\" which isn't in the experiment");
+
+		expected.clear();
+		it->second->WriteCheckpoint(expected);
+		if(expected.size() != count)
+			THROW_ARGOSEXCEPTION("Checkpoint state for \"" << id << "\" doesn't match its model");
+
+		modelStates.emplace_back(it->second, std::vector<float>(count));
+		reader.Read(modelStates.back().second.data(), count);
+	}
+
+	// Everything matches, static bodies were placed by the experiment and stay as ARGoS has them
+	for(size_t i = 0; i < bodies.size(); ++i)
+	{
+		if(bodies[i]->isStaticObject())
+			continue;
+
+		const btCollisionObjectData& objectData = bodyData[i].m_collisionObjectData;
+		btTransform transform;
+		btVector3 linearVelocity, angularVelocity;
+		transform.deSerialize(objectData.m_worldTransform);
+		linearVelocity.deSerialize(bodyData[i].m_linearVelocity);
+		angularVelocity.deSerialize(bodyData[i].m_angularVelocity);
+
+		CWorldSnapshot::RestoreBody(*bodies[i], transform, linearVelocity, angularVelocity,
+									objectData.m_activationState1, objectData.m_deactivationTime);
+	}
+
+	for(int i = 0; i < world.getNumConstraints(); ++i)
+	{
+		world.getConstraint(i)->setEnabled(constraintData[i].m_isEnabled != 0);
+		world.getConstraint(i)->setBreakingImpulseThreshold(constraintData[i].m_breakingImpulseThreshold);
+	}
+
+	const btScalar* values = reinterpret_cast<const btScalar*>(multiBodyData);
+	for(int i = 0; multiBodyWorld && i < multiBodyWorld->getNumMultibodies(); ++i)
+	{
+		btMultiBody* multiBody = multiBodyWorld->getMultiBody(i);
+		btTransform base{btQuaternion{values[3], values[4], values[5], values[6]}, btVector3{values[0], values[1], values[2]}};
+		CWorldSnapshot::RestoreMultiBody(*multiBody, base, btVector3{values[7], values[8], values[9]},
+										 btVector3{values[10], values[11], values[12]}, values + MULTIBODY_BASE_VALUES,
+										 values[13] != 0);
+
+		values += MULTIBODY_BASE_VALUES;
+		for(int link = 0; link < multiBody->getNumLinks(); ++link)
+			values += multiBody->getLink(link).m_posVarCount + multiBody->getLink(link).m_dofCount;
+	}
+
+	for(auto& state : modelStates)
+		state.first->ReadCheckpoint(state.second);
+
+	simulationClock = (uint32_t)header.simulationClock;
+}
+
+/**
+ * Map the file so the sections are read in place rather than copied in first
+ */
+bool readCheckpoint(const std::string& file, btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld,
+					const CBulletEngine::TMap& models, uint32_t& simulationClock)
+{
+	SMappedAsset mapping;
+	if(!mapAssetCache(file, mapping))
+		return false;
+
+	try
+	{
+		applyCheckpoint(mapping.data, mapping.size, world, multiBodyWorld, models, simulationClock);
+	}
+	catch(CARGoSException& ex)
+	{
+		unmapAssetCache(mapping);
+		THROW_ARGOSEXCEPTION_NESTED("Unable to resume from checkpoint \"" << file << "\"", ex);
+	}
+
+	unmapAssetCache(mapping);
+	return true;
+}
@@ -0,0 +1,34 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#ifndef ARGOS3_BULLET_WORLDCHECKPOINT_H
+#define ARGOS3_BULLET_WORLDCHECKPOINT_H
+
+#include "CBulletEngine.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Checkpoint files let a long run carry on after a crash or preemption. They hold the state of every rigid body and
+ * constraint (written by bullet's own serializer), every btMultiBody and whatever extra state models keep for
+ * themselves (motor targets...). Shapes, masses and everything else set up from the XML are not stored, a checkpoint
+ * can only be loaded into a world built from the same experiment.
+ */
+
+/**
+ * Write the world's state to a checkpoint file, replacing it in one go so a crash part way through leaves the
+ * previous checkpoint intact. Returns false if it can't be written.
+ */
+bool writeCheckpoint(const std::string& file, btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld,
+					 const CBulletEngine::TMap& models, uint32_t simulationClock);
+
+/**
+ * Map a checkpoint file and put the world and models back as they were when it was written. Returns false if there
+ * is no checkpoint, throws if it doesn't belong to this experiment. The broadphase is left for the caller to rebuild.
+ */
+bool readCheckpoint(const std::string& file, btDynamicsWorld& world, btMultiBodyDynamicsWorld* multiBodyWorld,
+					const CBulletEngine::TMap& models, uint32_t& simulationClock);
+
+#endif //ARGOS3_BULLET_WORLDCHECKPOINT_H
@@ -1144,10 +1144,8 @@ void	btDiscreteDynamicsWorld::startProfiling(btScalar timeStep)
 {
 	(void)timeStep;
 
-#ifndef BT_NO_PROFILE
-	CProfileManager::Reset();
-#endif //BT_NO_PROFILE
-
+	///The profile tree is shared by every world and reset by whoever reads it, not by each step.
+	///Several worlds stepping at once would otherwise reset it from several threads. Modified for bullet-for-argos.
 }
 
 
@@ -105,6 +105,8 @@ btMultiBody::btMultiBody(int n_links,
 		m_awake(true),
 		m_canSleep(canSleep),
 		m_sleepTimer(0),
+		m_sleepEpsilon(SLEEP_EPSILON),
+		m_sleepTimeout(SLEEP_TIMEOUT),
 		
 		m_linearDamping(0.04f),
 		m_angularDamping(0.04f),
@@ -2366,9 +2368,9 @@ void btMultiBody::checkMotionAndSleepIfRequired(btScalar timestep)
 	}  
     
 
-    if (motion < SLEEP_EPSILON) {
+    if (motion < m_sleepEpsilon) {
         m_sleepTimer += timestep;
-        if (m_sleepTimer > SLEEP_TIMEOUT) {
+        if (m_sleepTimer > m_sleepTimeout) {
             goToSleep();
         }
     } else {
@@ -500,6 +500,18 @@ void addJointTorque(int i, btScalar Q);
 		return m_canSleep;
 	}
 
+	///Sum of squared velocities (base and joints) below which the body counts as resting, modified for bullet-for-argos
+	void	setSleepThreshold(btScalar sleepEpsilon)
+	{
+		m_sleepEpsilon = sleepEpsilon;
+	}
+
+	///Time the body must rest before it sleeps, modified for bullet-for-argos
+	void	setSleepTimeout(btScalar sleepTimeout)
+	{
+		m_sleepTimeout = sleepTimeout;
+	}
+
     bool isAwake() const { return m_awake; }
     void wakeUp();
     void goToSleep();
@@ -692,6 +704,8 @@ private:
     bool m_awake;
     bool m_canSleep;
     btScalar m_sleepTimer;
+    btScalar m_sleepEpsilon;
+    btScalar m_sleepTimeout;
 
 	int	m_companionId;
 	btScalar	m_linearDamping;
@@ -20,6 +20,15 @@
 
 static btClock gProfileClock;
 
+///The profile tree is not thread safe, only a thread which has been marked with Set_Profiling_Thread records samples.
+///Samples from every other thread (e.g. parallel island solving, other worlds) are ignored. Modified for bullet-for-argos.
+static thread_local bool gIsProfilingThread = false;
+
+static bool isProfilingThread()
+{
+	return gIsProfilingThread;
+}
+
 
 #ifdef __CELLOS_LV2__
 #include <sys/sys_time.h>
@@ -455,6 +464,9 @@ unsigned long int			CProfileManager::ResetTime = 0;
  *=============================================================================================*/
 void	CProfileManager::Start_Profile( const char * name )
 {
+	if (!isProfilingThread())
+		return;
+
 	if (name != CurrentNode->Get_Name()) {
 		CurrentNode = CurrentNode->Get_Sub_Node( name );
 	}
@@ -468,6 +480,9 @@ void	CProfileManager::Start_Profile( const char * name )
  *=============================================================================================*/
 void	CProfileManager::Stop_Profile( void )
 {
+	if (!isProfilingThread())
+		return;
+
 	// Return will indicate whether we should back up to our parent (we may
 	// be profiling a recursive function)
 	if (CurrentNode->Return()) {
@@ -476,6 +491,17 @@ void	CProfileManager::Stop_Profile( void )
 }
 
 
+/***********************************************************************************************
+ * CProfileManager::Set_Profiling_Thread -- Start or stop recording samples on this thread    *
+ *                                                                                             *
+ * Only one thread may record at a time. Modified for bullet-for-argos.                        *
+ *=============================================================================================*/
+void	CProfileManager::Set_Profiling_Thread( bool profiling )
+{
+	gIsProfilingThread = profiling;
+}
+
+
 /***********************************************************************************************
  * CProfileManager::Reset -- Reset the contents of the profiling system                       *
  *                                                                                             *
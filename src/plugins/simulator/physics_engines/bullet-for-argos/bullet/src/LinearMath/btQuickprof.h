@@ -148,6 +148,9 @@ public:
 	static	void						Start_Profile( const char * name );
 	static	void						Stop_Profile( void );
 
+	///Only the calling thread records samples while set, modified for bullet-for-argos
+	static	void						Set_Profiling_Thread( bool profiling );
+
 	static	void						CleanupMemory(void)
 	{
 		Root.CleanupMemory();
@@ -0,0 +1,128 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "CBatchRayCaster.h"
+
+/**
+ * Nearest hit of a ray against anything with a user pointer, as the engine's single ray query looks for
+ */
+struct SClosestCallback : public btCollisionWorld::RayResultCallback
+{
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace) override
+	{
+		if(!rayResult.m_collisionObject->getUserPointer())
+			return m_closestHitFraction;
+
+		m_collisionObject = rayResult.m_collisionObject;
+		m_closestHitFraction = rayResult.m_hitFraction;
+		return m_closestHitFraction;
+	}
+};
+
+/**
+ * Cast the same rays from several threads at once, single and batched, and check every thread sees what
+ * btCollisionWorld::rayTest sees on its own. Run under a thread sanitizer to catch shared traversal state.
+ *
+ * Usage: argos3_bullet_test_concurrent_rays
+ */
+int main(int argc, char** argv)
+{
+	btDefaultCollisionConfiguration configuration;
+	btCollisionDispatcher dispatcher{&configuration};
+	btDbvtBroadphase broadphase;
+	btCollisionWorld world{&dispatcher, &broadphase, &configuration};
+
+	// A grid of boxes above a ground plane, which is not an ARGoS model so is never reported
+	btStaticPlaneShape groundShape{btVector3{0, 0, 1}, 0};
+	btCollisionObject ground;
+	ground.setCollisionShape(&groundShape);
+	world.addCollisionObject(&ground);
+
+	btBoxShape boxShape{btVector3{0.2, 0.2, 0.2}};
+	std::vector<btCollisionObject*> boxes;
+	for(int x = 0; x < 10; ++x)
+	{
+		for(int y = 0; y < 10; ++y)
+		{
+			btCollisionObject* box = new btCollisionObject;
+			box->setCollisionShape(&boxShape);
+			box->setWorldTransform(btTransform{btQuaternion::getIdentity(), btVector3{x - 4.5f, y - 4.5f, 0.2f}});
+			box->setUserPointer(box);
+			world.addCollisionObject(box);
+			boxes.push_back(box);
+		}
+	}
+	world.updateAabbs();
+
+	// Rays from above the middle fanning out and down, plenty of which miss
+	const int numRays = 512;
+	std::vector<btVector3> from(numRays), to(numRays);
+	std::vector<CBatchRayCaster::SRayResult> expected(numRays);
+	for(int i = 0; i < numRays; ++i)
+	{
+		btScalar angle = SIMD_2_PI * i / numRays;
+		from[i] = btVector3{0, 0, 1};
+		to[i] = btVector3{btCos(angle) * (3 + i % 5), btSin(angle) * (3 + i % 5), btScalar(-0.5)};
+
+		SClosestCallback callback;
+		world.rayTest(from[i], to[i], callback);
+		expected[i] = CBatchRayCaster::SRayResult{callback.m_collisionObject, callback.m_closestHitFraction};
+	}
+
+	WorkerPool pool{4};
+	CBatchRayCaster caster{broadphase, &pool};
+
+	const int numThreads = 8;
+	std::vector<int> failures(numThreads, 0);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < numThreads; ++t)
+	{
+		threads.emplace_back([&, t]()
+		{
+			for(int repeat = 0; repeat < 20; ++repeat)
+			{
+				for(int i = 0; i < numRays; ++i)
+				{
+					SClosestCallback callback;
+					caster.CastRay(from[i], to[i], callback);
+					if(callback.m_collisionObject != expected[i].object ||
+					   (callback.hasHit() && btFabs(callback.m_closestHitFraction - expected[i].fraction) > 1e-4f))
+						++failures[t];
+				}
+
+				std::vector<CBatchRayCaster::SRayResult> results(numRays);
+				caster.CastRays(from.data(), to.data(), numRays, results.data());
+				for(int i = 0; i < numRays; ++i)
+					if(results[i].object != expected[i].object)
+						++failures[t];
+			}
+		});
+	}
+
+	for(auto& thread : threads)
+		thread.join();
+
+	int total = 0;
+	for(int t = 0; t < numThreads; ++t)
+		total += failures[t];
+
+	for(auto box : boxes)
+	{
+		world.removeCollisionObject(box);
+		delete box;
+	}
+	world.removeCollisionObject(&ground);
+
+	if(total)
+	{
+		std::cerr << total << " ray results differed from btCollisionWorld::rayTest" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "CParallelCollisionDispatcher.h"
+#include "CParallelDynamicsWorld.h"
+
+/**
+ * Step a stack of boxes in a deterministic parallel world on the given number of threads and hash where they end up
+ */
+static uint64_t hashWorld(unsigned int numThreads)
+{
+	btDefaultCollisionConfiguration configuration;
+	WorkerPool pool{numThreads};
+	CParallelCollisionDispatcher dispatcher{&configuration, pool};
+	dispatcher.SetDeterministic(true);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	CParallelDynamicsWorld world{&dispatcher, &broadphase, &solver, &configuration, pool};
+	world.SetDeterministic(true);
+
+	// A randomised solver order is the hardest case, each island has to reseed the same way on any thread
+	world.getSolverInfo().m_solverMode |= SOLVER_RANDMIZE_ORDER;
+	world.setGravity(btVector3{0, 0, -9.81f});
+
+	btStaticPlaneShape groundShape{btVector3{0, 0, 1}, 0};
+	btDefaultMotionState groundMotion;
+	btRigidBody ground{0, &groundMotion, &groundShape};
+	world.addRigidBody(&ground);
+
+	// 576 slightly skewed boxes in layers, so they topple into islands which merge and split as the world steps
+	btBoxShape boxShape{btVector3{0.1f, 0.1f, 0.1f}};
+	btVector3 inertia;
+	boxShape.calculateLocalInertia(1, inertia);
+
+	std::vector<btRigidBody*> boxes;
+	for(int x = 0; x < 12; ++x)
+	{
+		for(int y = 0; y < 12; ++y)
+		{
+			for(int z = 0; z < 4; ++z)
+			{
+				btTransform transform{btQuaternion{btScalar(0.1*x), btScalar(0.05*y), btScalar(0.02*z)},
+									  btVector3{btScalar(x*0.5 + (z % 2)*0.05), btScalar(y*0.5 + z*0.03), btScalar(0.15 + z*0.21)}};
+				btRigidBody* box = new btRigidBody{1, new btDefaultMotionState{transform}, &boxShape, inertia};
+				world.addRigidBody(box);
+				boxes.push_back(box);
+			}
+		}
+	}
+
+	for(int step = 0; step < 600; ++step)
+		world.stepSimulation(btScalar(1.0/60), 1, btScalar(1.0/60));
+
+	// FNV-1a over the bits of every box's transform and velocities, bit identical means identical
+	uint64_t hash = 14695981039346656037ull;
+	for(auto box : boxes)
+	{
+		btTransform transform = box->getWorldTransform();
+		btVector3 motion[2] = {box->getLinearVelocity(), box->getAngularVelocity()};
+		const unsigned char* bytes[2] = {(const unsigned char*)&transform, (const unsigned char*)motion};
+		size_t sizes[2] = {sizeof(transform), sizeof(motion)};
+
+		for(int part = 0; part < 2; ++part)
+		{
+			for(size_t i = 0; i < sizes[part]; ++i)
+			{
+				hash ^= bytes[part][i];
+				hash *= 1099511628211ull;
+			}
+		}
+	}
+
+	for(auto box : boxes)
+	{
+		world.removeRigidBody(box);
+		delete box->getMotionState();
+		delete box;
+	}
+	world.removeRigidBody(&ground);
+
+	return hash;
+}
+
+/**
+ * Step the same world in deterministic mode with 1, 2, 4 and 8 threads and check every run ends bit identical.
+ *
+ * Usage: argos3_bullet_test_determinism
+ */
+int main(int argc, char** argv)
+{
+	uint64_t expected = hashWorld(1);
+
+	int failures = 0;
+	for(unsigned int numThreads : {2u, 4u, 8u})
+	{
+		uint64_t hash = hashWorld(numThreads);
+		if(hash != expected)
+		{
+			std::cerr << "World stepped on " << numThreads << " threads hashed to " << std::hex << hash
+					  << " rather than " << expected << std::dec << std::endl;
+			++failures;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
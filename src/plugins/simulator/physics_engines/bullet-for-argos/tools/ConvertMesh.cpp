@@ -0,0 +1,44 @@
+//
+// Created by richard on 17/10/26.
+//
+
+#include <iostream>
+#include <string>
+
+#include "MeshInfo.h"
+
+/**
+ * Convert an OBJ mesh to the binary mesh format so it can be mapped rather than parsed. Textures are looked
+ * up relative to the binary mesh so it should sit next to the OBJ's images, which it does by default.
+ *
+ * Usage: argos3_bullet_convert_mesh input.obj [output.bmesh]
+ */
+int main(int argc, char** argv)
+{
+	if(argc < 2 || argc > 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " input.obj [output.bmesh]" << std::endl;
+		return 1;
+	}
+
+	// Default to the input's name with the extension swapped
+	std::string input = argv[1];
+	std::string output = argc == 3 ? argv[2] : input.substr(0, input.find_last_of('.')) + ".bmesh";
+
+	MeshInfo mesh;
+	if(!mesh.LoadFromObj(input))
+	{
+		std::cerr << "Failed to load " << input << std::endl;
+		return 1;
+	}
+
+	// The result stands alone so it isn't tied to the hash of its source
+	if(!mesh.SaveToBinary(output, 0))
+	{
+		std::cerr << "Failed to write " << output << std::endl;
+		return 1;
+	}
+
+	std::cout << "Wrote " << mesh.subMeshes.size() << " sub-meshes to " << output << std::endl;
+	return 0;
+}